@@ -1,6 +1,9 @@
 #include "my_dictionary.h"
 
 #include <gtest/gtest.h>
+#include <limits>
+#include <random>
+#include <sstream>
 
 using namespace std;
 
@@ -272,5 +275,1711 @@ TEST(hash_testing, multiple_values){
         EXPECT_EQ(values[i], int_dict.Get(values[i]));
 }
 
+TEST(flat_hash_testing, touch_diff_types) {
+    FlatHashDictionary<char, int> char_dict;
+    char_dict.Set('0', 1);
+    EXPECT_EQ(char_dict.Get('0'), 1);
+    EXPECT_FALSE(char_dict.IsSet('1'));
+
+    FlatHashDictionary<string, string> string_dict;
+    string_dict.Set("1", "10");
+    string_dict.Set("1", "20");
+    EXPECT_EQ(string_dict.Get("1"), "20");
+    EXPECT_THROW(string_dict.Get("2"), DictionaryNotFoundException<string>);
+
+    FlatHashDictionary<C, C> C_dict;
+    C c1(10, 10), c2(10, -1);
+    C_dict.Set(c1, c2);
+    EXPECT_EQ(C_dict.Get(c1), c2);
+    EXPECT_FALSE(C_dict.IsSet(c2));
+}
+
+TEST(flat_hash_testing, multiple_values){
+    FlatHashDictionary<int, int> int_dict;
+    const int MAX_VAlUES = 500000;
+    std::vector<int> values(MAX_VAlUES);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        values[i] = i;
+
+    std::random_shuffle(values.begin(), values.end());
+
+    for (int i = 0; i < MAX_VAlUES; i++)
+        int_dict.Set(values[i], values[i]);
+
+    std::random_shuffle(values.begin(), values.end());
+
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(values[i], int_dict.Get(values[i]));
+    EXPECT_FALSE(int_dict.IsSet(MAX_VAlUES));
+}
+
+TEST(hash_testing, incremental_resize){
+    HashDictionary<int, int> int_dict;
+    int_dict.SetIncrementalResize(16);
+    const int MAX_VAlUES = 200000;
+    std::vector<int> values(MAX_VAlUES);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        values[i] = i;
+
+    std::random_shuffle(values.begin(), values.end());
+
+    std::size_t resizes = 0;
+    for (int i = 0; i < MAX_VAlUES; i++) {
+        std::size_t buckets = int_dict.BucketCount(), pending = int_dict.PendingBuckets();
+        int_dict.Set(values[i], values[i]);
+        if (int_dict.BucketCount() != buckets && buckets != 0) {
+            //the triggering Set only swaps tables: every old bucket waits and is still searched
+            resizes++;
+            EXPECT_EQ(pending, 0u);
+            EXPECT_EQ(int_dict.PendingBuckets(), buckets);
+            for (int j = 0; j < i; j += 7) {
+                EXPECT_EQ(values[j], int_dict.Get(values[j]));
+            }
+        } else if (pending != 0) {
+            //far from the next resize, so each Set moves exactly the requested 16 buckets or the rest
+            EXPECT_EQ(pending - int_dict.PendingBuckets(), std::min<std::size_t>(pending, 16));
+        }
+        if (i % 1000 == 0) {
+            for (int j = 0; j <= i; j += 97) {
+                EXPECT_EQ(values[j], int_dict.Get(values[j]));
+            }
+        }
+    }
+    EXPECT_GE(resizes, 2u);
+
+    for (int i = 0; i < MAX_VAlUES; i += 2)
+        int_dict.Set(values[i], -values[i]);
+
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(i % 2 == 0 ? -values[i] : values[i], int_dict.Get(values[i]));
+    EXPECT_FALSE(int_dict.IsSet(MAX_VAlUES));
+
+    //a copy taken in the middle of a migration owns both of its tables
+    while (int_dict.PendingBuckets() == 0)
+        int_dict.Set(MAX_VAlUES + int(int_dict.Size()), 0);
+    for (int i = 0; i < 4; i++)
+        int_dict.Set(values[i], int_dict.Get(values[i]));
+    HashDictionary<int, int> copy = int_dict;
+    int_dict.SetIncrementalResize(0);
+    EXPECT_NE(copy.PendingBuckets(), 0u);
+    EXPECT_EQ(copy.Size(), int_dict.Size());
+    for (int i = 0; i < MAX_VAlUES; i += 3)
+        EXPECT_EQ(copy.Get(values[i]), int_dict.Get(values[i]));
+    //and holds every entry once: migrated old buckets are not copied along
+    std::size_t copied = copy.Size();
+    EXPECT_EQ(copy.EraseIf([](const int &, const int &) { return true; }), copied);
+    EXPECT_EQ(copy.Size(), 0u);
+}
+
+struct D {
+    int val;
+    static int hash_calls;
+
+    explicit D(int v) : val(v) {}
+
+    friend bool operator==(const D &d1, const D &d2) { return d1.val == d2.val; }
+};
+int D::hash_calls = 0;
+namespace std {
+    template<>
+    struct hash<D> {
+        std::size_t operator()(D const &d) const noexcept {
+            D::hash_calls++;
+            return std::hash<int>{}(d.val);
+        }
+    };
+}
+
+TEST(hash_testing, rehash_uses_cached_hash){
+    HashDictionary<D, int> D_dict;
+    const int MAX_VAlUES = 50000;
+    D::hash_calls = 0;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        D_dict.Set(D(i), i);
+    EXPECT_EQ(D::hash_calls, MAX_VAlUES);
+
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(i, D_dict.Get(D(i)));
+    EXPECT_FALSE(D_dict.IsSet(D(MAX_VAlUES)));
+}
+
+TEST(hash_testing, reserve_and_lazy_table){
+    HashDictionary<int, int> lazy_dict;
+    EXPECT_EQ(lazy_dict.BucketCount(), 0u);
+    EXPECT_FALSE(lazy_dict.IsSet(1));
+    EXPECT_THROW(lazy_dict.Get(1), DictionaryNotFoundException<int>);
+    //a default table starts small
+    lazy_dict.Set(1, 1);
+    EXPECT_LE(lazy_dict.BucketCount(), 16u);
+
+    HashDictionary<int, int> small_dict(3, 0.75);
+    EXPECT_EQ(small_dict.BucketCount(), 0u);
+    small_dict.Set(1, 10);
+    small_dict.Set(2, 20);
+    small_dict.Set(3, 30);
+    std::size_t buckets = small_dict.BucketCount();
+    EXPECT_LT(buckets, 10u);
+    EXPECT_EQ(small_dict.Size(), 3u);
+    EXPECT_EQ(small_dict.Get(3), 30);
+
+    HashDictionary<int, int> int_dict;
+    const int MAX_VAlUES = 100000;
+    int_dict.SetMaxLoadFactor(1.0);
+    int_dict.SetGrowthFactor(2);
+    int_dict.Reserve(MAX_VAlUES);
+    int_dict.Set(0, 0);
+    buckets = int_dict.BucketCount();
+    for (int i = 0; i < MAX_VAlUES; i++)
+        int_dict.Set(i, i);
+    EXPECT_EQ(buckets, int_dict.BucketCount());
+    EXPECT_EQ(int_dict.Size(), std::size_t(MAX_VAlUES));
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(i, int_dict.Get(i));
+
+    FlatHashDictionary<int, int> flat_dict;
+    EXPECT_EQ(flat_dict.BucketCount(), 0u);
+    flat_dict.Reserve(MAX_VAlUES);
+    buckets = flat_dict.BucketCount();
+    for (int i = 0; i < MAX_VAlUES; i++)
+        flat_dict.Set(i, i);
+    EXPECT_EQ(buckets, flat_dict.BucketCount());
+    EXPECT_EQ(flat_dict.Size(), std::size_t(MAX_VAlUES));
+
+    //load factors out of [1/64, 64] are clamped to it
+    const double bad_loads[] = {0.0, -1.0, std::numeric_limits<double>::quiet_NaN()};
+    for (double load : bad_loads) {
+        HashDictionary<int, int> sparse_dict(10, load);
+        for (int i = 0; i < 1000; i++)
+            sparse_dict.Set(i, i);
+        EXPECT_GE(sparse_dict.BucketCount(), 64 * sparse_dict.Size());
+        EXPECT_EQ(sparse_dict.Get(999), 999);
+        sparse_dict.SetMaxLoadFactor(load);
+        sparse_dict.Set(1000, 1000);
+        EXPECT_EQ(sparse_dict.Size(), 1001u);
+    }
+    HashDictionary<int, int> dense_dict;
+    dense_dict.SetMaxLoadFactor(std::numeric_limits<double>::infinity());
+    for (int i = 0; i < 10000; i++)
+        dense_dict.Set(i, i);
+    EXPECT_GE(64 * dense_dict.BucketCount(), dense_dict.Size());
+    EXPECT_EQ(dense_dict.Get(9999), 9999);
+}
+
+TEST(hash_testing, erase){
+    HashDictionary<int, int> int_dict;
+    int_dict.SetIncrementalResize(8);
+    const int MAX_VAlUES = 100000;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        int_dict.Set(i, i);
+    //the default FibonacciIndex keeps power-of-two tables under the 25% load limit
+    std::size_t buckets = int_dict.BucketCount();
+    EXPECT_EQ(buckets & (buckets - 1), 0u);
+    EXPECT_LE(int_dict.Size() * 4, buckets);
+    for (int i = 1; i < MAX_VAlUES; i += 2)
+        EXPECT_TRUE(int_dict.Erase(i));
+    EXPECT_FALSE(int_dict.Erase(1));
+    EXPECT_EQ(int_dict.Size(), std::size_t(MAX_VAlUES / 2));
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(int_dict.IsSet(i), i % 2 == 0);
+    EXPECT_EQ(int_dict.EraseIf([](const int &, const int &) { return true; }), std::size_t(MAX_VAlUES / 2));
+    EXPECT_EQ(int_dict.Size(), 0u);
+    //an empty table shrinks back to the default minimum
+    EXPECT_EQ(int_dict.BucketCount(), 16u);
+}
+
+//EraseIf while old buckets wait: migrated ones are empty and are not counted again
+TEST(hash_testing, erase_if_during_resize){
+    HashDictionary<int, int> int_dict;
+    int_dict.SetIncrementalResize(1);
+    for (int i = 0; i < 7; i++)
+        int_dict.Set(i, i);
+    EXPECT_NE(int_dict.PendingBuckets(), 0u);
+    EXPECT_EQ(int_dict.EraseIf([](const int &, const int &) { return true; }), 7u);
+    ASSERT_EQ(int_dict.Size(), 0u);
+
+    const int MAX_VAlUES = 10000;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        int_dict.Set(i, i);
+    while (int_dict.PendingBuckets() == 0)
+        int_dict.Set(int(int_dict.Size()), int(int_dict.Size()));
+    for (int i = 0; i < 10 && int_dict.PendingBuckets() > 1; i++)
+        int_dict.Set(i, i);
+    std::size_t size = int_dict.Size();
+    EXPECT_NE(int_dict.PendingBuckets(), 0u);
+    EXPECT_EQ(int_dict.EraseIf([](const int &key, const int &) { return key % 2 == 1; }), size / 2);
+    EXPECT_EQ(int_dict.Size(), size - size / 2);
+    for (int i = 0; i < int(size); i++)
+        EXPECT_EQ(int_dict.IsSet(i), i % 2 == 0);
+}
+
+TEST(flat_hash_testing, erase){
+    FlatHashDictionary<int, int> int_dict;
+    const int MAX_VAlUES = 100000;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        int_dict.Set(i, i);
+    for (int i = 1; i < MAX_VAlUES; i += 2)
+        EXPECT_TRUE(int_dict.Erase(i));
+    EXPECT_FALSE(int_dict.Erase(1));
+    EXPECT_EQ(int_dict.Size(), std::size_t(MAX_VAlUES / 2));
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(int_dict.IsSet(i), i % 2 == 0);
+    EXPECT_EQ(int_dict.EraseIf([](const int &, const int &) { return true; }), std::size_t(MAX_VAlUES / 2));
+    EXPECT_EQ(int_dict.Size(), 0u);
+    EXPECT_EQ(int_dict.BucketCount(), 16u);
+
+    FlatHashDictionary<string, int> churn_dict;
+    for (int i = 0; i < 100000; i++) {
+        churn_dict.Set(to_string(i), i);
+        if (i >= 10) {
+            EXPECT_TRUE(churn_dict.Erase(to_string(i - 10)));
+        }
+    }
+    EXPECT_EQ(churn_dict.Size(), 10u);
+    EXPECT_LE(churn_dict.BucketCount(), 64u);
+    EXPECT_EQ(churn_dict.Get("99999"), 99999);
+}
+
+//batch of present and missing keys, longer than a found-bitmap word and not a multiple of the batch size
+template<class Dict>
+void check_batch_lookup(Dict &int_dict) {
+    const int MAX_VAlUES = 100000;
+    const int BATCH = 333;
+    std::vector<int> keys(MAX_VAlUES), values(MAX_VAlUES);
+    for (int i = 0; i < MAX_VAlUES; i++) {
+        keys[i] = 2 * i;
+        values[i] = i;
+    }
+    int_dict.SetMany(keys.data(), values.data(), MAX_VAlUES);
+
+    std::vector<int> batch_keys(BATCH), batch_values(BATCH, -1);
+    std::vector<std::uint64_t> found((BATCH + 63) / 64, ~std::uint64_t(0));
+    for (int i = 0; i < BATCH; i++)
+        batch_keys[i] = i * 7;
+
+    std::size_t hits = int_dict.GetMany(batch_keys.data(), BATCH, batch_values.data(), found.data());
+    EXPECT_EQ(hits, std::size_t((BATCH + 1) / 2));
+    for (int i = 0; i < BATCH; i++) {
+        bool is_found = (found[i / 64] >> (i % 64)) & 1;
+        EXPECT_EQ(is_found, i % 2 == 0);
+        EXPECT_EQ(batch_values[i], is_found ? i * 7 / 2 : -1);
+    }
+}
+
+TEST(hash_testing, batch_lookup){
+    HashDictionary<int, int> int_dict;
+    check_batch_lookup(int_dict);
+}
+
+TEST(flat_hash_testing, batch_lookup){
+    FlatHashDictionary<int, int> int_dict;
+    check_batch_lookup(int_dict);
+}
+
+//batches whose keys are split between both tables of an incremental resize,
+//and a SetMany batch during which the table grows
+TEST(hash_testing, batch_during_resize){
+    HashDictionary<int, int> int_dict;
+    int_dict.SetIncrementalResize(1);
+    const int BATCH = 100;
+    int size = 0;
+    while (int_dict.PendingBuckets() == 0 || size < 1000) {
+        int_dict.Set(size, -size);
+        size++;
+    }
+    std::size_t pending = int_dict.PendingBuckets();
+    EXPECT_GT(pending, std::size_t(BATCH));
+
+    std::vector<int> batch_keys(size + BATCH), batch_values(size + BATCH, 1);
+    std::vector<std::uint64_t> found((size + BATCH + 63) / 64);
+    for (int i = 0; i < size + BATCH; i++)
+        batch_keys[i] = i;
+    EXPECT_EQ(int_dict.GetMany(batch_keys.data(), size + BATCH, batch_values.data(), found.data()),
+              std::size_t(size));
+    EXPECT_EQ(int_dict.PendingBuckets(), pending);
+    for (int i = 0; i < size + BATCH; i++) {
+        EXPECT_EQ((found[i / 64] >> (i % 64)) & 1, i < size ? 1u : 0u);
+        EXPECT_EQ(batch_values[i], i < size ? -i : 1);
+    }
+
+    //updates of old keys migrate one bucket per key, new keys reach the next resize
+    std::size_t buckets = int_dict.BucketCount();
+    std::vector<int> set_keys, set_values;
+    for (int i = 0; int_dict.BucketCount() == buckets && i < 1000000; i++) {
+        set_keys.assign(BATCH, 0);
+        set_values.assign(BATCH, 0);
+        for (int j = 0; j < BATCH; j++) {
+            set_keys[j] = j % 2 == 0 ? j : size;
+            set_values[j] = j % 2 == 0 ? j : -size;
+            size += j % 2;
+        }
+        int_dict.SetMany(set_keys.data(), set_values.data(), BATCH);
+    }
+    EXPECT_NE(int_dict.BucketCount(), buckets);
+    EXPECT_EQ(int_dict.Size(), std::size_t(size));
+    for (int i = 0; i < size; i++)
+        EXPECT_EQ(int_dict.Get(i), i < BATCH && i % 2 == 0 ? i : -i);
+}
+
+//value whose copy throws once armed
+struct ThrowingCopy {
+    int val;
+    static bool armed;
 
+    explicit ThrowingCopy(int v) : val(v) {}
 
+    ThrowingCopy(const ThrowingCopy &other) : val(other.val) {
+        if (armed)
+            throw std::runtime_error("copy");
+    }
+
+    ThrowingCopy(ThrowingCopy &&other) noexcept = default;
+
+    ThrowingCopy &operator=(const ThrowingCopy &other) = default;
+};
+bool ThrowingCopy::armed = false;
+
+//a throwing value constructor leaves the size and the keys as they were, also where the insert grows the table
+template<class Dict>
+void check_throwing_insert(Dict &dict) {
+    const ThrowingCopy value(1);
+    for (int i = 0; i < 2000; i += 2)
+        dict.Set(i, value);
+    ThrowingCopy::armed = true;
+    auto factory = []() -> ThrowingCopy {
+        throw std::runtime_error("factory");
+    };
+    for (int i = 1; i < 2000; i += 2) {
+        EXPECT_THROW(dict.Set(i, value), std::runtime_error);
+        EXPECT_THROW(dict.GetOrInsert(i, factory), std::runtime_error);
+        EXPECT_EQ(dict.Size(), 1000u);
+    }
+    dict.Set(0, value);
+    ThrowingCopy::armed = false;
+    for (int i = 0; i < 2000; i++)
+        EXPECT_EQ(dict.IsSet(i), i % 2 == 0);
+    for (int i = 1; i < 2000; i += 2)
+        dict.Set(i, ThrowingCopy(i));
+    EXPECT_EQ(dict.Size(), 2000u);
+    EXPECT_EQ(dict.Get(1999).val, 1999);
+}
+
+TEST(hash_testing, throwing_insert){
+    HashDictionary<int, ThrowingCopy> dict;
+    check_throwing_insert(dict);
+    HashDictionary<int, ThrowingCopy> incremental_dict;
+    incremental_dict.SetIncrementalResize(1);
+    check_throwing_insert(incremental_dict);
+}
+
+TEST(flat_hash_testing, throwing_insert){
+    FlatHashDictionary<int, ThrowingCopy> dict;
+    check_throwing_insert(dict);
+}
+
+struct CaseInsensitiveHash {
+    std::size_t operator()(const string &key) const {
+        string lower(key);
+        for (char &c : lower)
+            c = static_cast<char>(tolower(c));
+        return MixHash<string>{}(lower);
+    }
+};
+
+struct CaseInsensitiveEqual {
+    bool operator()(const string &s1, const string &s2) const {
+        return s1.size() == s2.size() && equal(s1.begin(), s1.end(), s2.begin(), [](char c1, char c2) {
+            return tolower(c1) == tolower(c2);
+        });
+    }
+};
+
+TEST(hash_testing, policies){
+    //strided keys are the bad case for identity std::hash with power of two tables
+    const int MAX_VAlUES = 50000;
+    HashDictionary<int, int> fibonacci_dict;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        fibonacci_dict.Set(i * 1024, i);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(i, fibonacci_dict.Get(i * 1024));
+    EXPECT_FALSE(fibonacci_dict.IsSet(1));
+    HashDictionary<int, int, FastHashPolicy<int>> mask_dict;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        mask_dict.Set(i * 1024, i);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(i, mask_dict.Get(i * 1024));
+    EXPECT_FALSE(mask_dict.IsSet(1));
+    HashDictionary<int, int, HashPolicy<int, FibonacciHash<int>, std::equal_to<int>, FastRangeIndex>> range_dict;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        range_dict.Set(i * 1024, i);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(i, range_dict.Get(i * 1024));
+    EXPECT_FALSE(range_dict.IsSet(1));
+    HashDictionary<int, int, HashPolicy<int, std::hash<int>, std::equal_to<int>, ModuloIndex>> modulo_dict;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        modulo_dict.Set(i * 1024, i);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(i, modulo_dict.Get(i * 1024));
+    EXPECT_FALSE(modulo_dict.IsSet(1));
+    EXPECT_EQ(modulo_dict.BucketCount() % 16, 0u);
+    //both tables grow the same 16 * 3^k requested size, the power-of-two one only rounds it up
+    EXPECT_EQ(fibonacci_dict.BucketCount(), MaskIndex::round_size(modulo_dict.BucketCount()));
+    FlatHashDictionary<int, int, FastHashPolicy<int>> flat_dict;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        flat_dict.Set(i * 1024, i);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(i, flat_dict.Get(i * 1024));
+    EXPECT_FALSE(flat_dict.IsSet(1));
+
+    HashDictionary<string, int, FastHashPolicy<string>> string_dict;
+    string_dict.Set("", 0);
+    string_dict.Set("long enough to take several words", 1);
+    EXPECT_EQ(string_dict.Get(""), 0);
+    EXPECT_EQ(string_dict.Get("long enough to take several words"), 1);
+    EXPECT_FALSE(string_dict.IsSet("long enough to take several words!"));
+
+    HashDictionary<string, int, HashPolicy<string, CaseInsensitiveHash, CaseInsensitiveEqual>> case_dict;
+    case_dict.Set("Key", 1);
+    case_dict.Set("KEY", 2);
+    EXPECT_EQ(case_dict.Get("key"), 2);
+    EXPECT_EQ(case_dict.Size(), 1u);
+    FlatHashDictionary<string, int, HashPolicy<string, CaseInsensitiveHash, CaseInsensitiveEqual>> flat_case_dict;
+    flat_case_dict.Set("Key", 1);
+    EXPECT_EQ(flat_case_dict.Get("kEY"), 1);
+}
+
+//value type counting its copies
+struct E {
+    std::vector<int> data;
+    static int copies;
+
+    E() = default;
+
+    explicit E(int size) : data(size) {}
+
+    E(const E &e) : data(e.data) { copies++; }
+
+    E(E &&e) = default;
+
+    E &operator=(const E &e) {
+        data = e.data;
+        copies++;
+        return *this;
+    }
+
+    E &operator=(E &&e) = default;
+};
+int E::copies = 0;
+
+//shared interface checks, on every engine with string keys and heterogeneous lookup
+template<class Dict>
+class engine_testing : public ::testing::Test {
+};
+
+typedef ::testing::Types<HashDictionary<string, E, FastHashPolicy<string>>,
+        FlatHashDictionary<string, E, FastHashPolicy<string>>,
+        TreeDictionary<string, E, std::less<>>,
+        TreeDictionary<string, E, std::less<>, SlabNodeAllocator<>>,
+        TreeDictionary<string, E, std::less<>, HeapNodeAllocator, true>,
+        PersistentTreeDictionary<string, E, std::less<>>,
+        CompactTreeDictionary<string, E, std::less<>>,
+        BTreeDictionary<string, E, std::less<>>,
+        ListDictionary<string, E, std::equal_to<>>,
+        ListDictionary<string, E, std::equal_to<>, SlabNodeAllocator<>>,
+        ListDictionary<string, E, std::equal_to<>, HeapNodeAllocator, MoveToFront>,
+        ListDictionary<string, E, std::equal_to<>, HeapNodeAllocator, Transpose>,
+        ListDictionary<string, E, std::equal_to<>, HeapNodeAllocator, CountOrder>,
+        UnrolledListDictionary<string, E, std::equal_to<>>> Engines;
+TYPED_TEST_SUITE(engine_testing, Engines);
+
+//TryGet and every miss policy of Get<MissPolicy>
+TYPED_TEST(engine_testing, miss_policies) {
+    TypeParam empty_dict;
+    EXPECT_EQ(empty_dict.TryGet("1"), nullptr);
+
+    TypeParam dict;
+    dict.Set("1", E(10));
+    EXPECT_EQ(dict.TryGet("1")->data.size(), 10u);
+    EXPECT_EQ(dict.TryGet("2"), nullptr);
+
+    EXPECT_EQ(dict.template Get<ThrowOnMiss>("1").data.size(), 10u);
+    EXPECT_THROW(dict.template Get<ThrowOnMiss>("2"), DictionaryNotFoundException<string>);
+    EXPECT_EQ(dict.template Get<DefaultOnMiss>("1").data.size(), 10u);
+    EXPECT_TRUE(dict.template Get<DefaultOnMiss>("2").data.empty());
+    EXPECT_EQ(dict.template Get<UncheckedOnMiss>("1").data.size(), 10u);
+    EXPECT_EQ(dict.Get("1").data.size(), 10u);
+}
+
+//string_view has no implicit conversion to string: these calls compile only through transparent overloads
+TYPED_TEST(engine_testing, transparent_lookup) {
+    TypeParam dict;
+    const string long_key = "a key well beyond the small string buffer";
+    dict.Set(long_key, E(1));
+    dict.Set("short", E(2));
+
+    string_view view(long_key);
+    EXPECT_EQ(dict.Get(view).data.size(), 1u);
+    EXPECT_EQ(dict.TryGet(view)->data.size(), 1u);
+    EXPECT_TRUE(dict.IsSet(view));
+    EXPECT_EQ(dict.Get("short").data.size(), 2u);
+    EXPECT_FALSE(dict.IsSet(string_view("missing")));
+    EXPECT_EQ(dict.TryGet(string_view("missing")), nullptr);
+    EXPECT_THROW(dict.Get(string_view("missing")), DictionaryNotFoundException<string>);
+    EXPECT_TRUE(dict.template Get<DefaultOnMiss>("missing").data.empty());
+}
+
+//erases one key and then every short key at once
+TYPED_TEST(engine_testing, erase) {
+    TypeParam dict;
+    for (int i = 0; i < 200; i++)
+        dict.Set(to_string(i), E(i % 3));
+    EXPECT_TRUE(dict.Erase("150"));
+    EXPECT_FALSE(dict.Erase("150"));
+    EXPECT_FALSE(dict.Erase("200"));
+    EXPECT_EQ(dict.EraseIf([](const string &key, const E &) { return key.size() < 3; }), 100u);
+    EXPECT_FALSE(dict.IsSet("99"));
+    EXPECT_FALSE(dict.IsSet("150"));
+    EXPECT_EQ(dict.Get("199").data.size(), 1u);
+    dict.Set("150", E(4));
+    EXPECT_EQ(dict.Get("150").data.size(), 4u);
+}
+
+TYPED_TEST(engine_testing, move_insertion) {
+    TypeParam dict;
+    E::copies = 0;
+    dict.Set("moved", E(3));
+    string key = "moved key";
+    E value(4);
+    dict.Set(std::move(key), std::move(value));
+    EXPECT_EQ(dict.Get("moved key").data.size(), 4u);
+    dict.Set("moved", E(5));
+    EXPECT_EQ(dict.Get("moved").data.size(), 5u);
+    EXPECT_EQ(E::copies, 0);
+
+    EXPECT_TRUE(dict.TryEmplace("emplaced", 6));
+    EXPECT_FALSE(dict.TryEmplace("emplaced", 7));
+    EXPECT_EQ(dict.Get("emplaced").data.size(), 6u);
+
+    int factory_calls = 0;
+    auto factory = [&factory_calls]() {
+        factory_calls++;
+        return E(8);
+    };
+    EXPECT_EQ(dict.GetOrInsert("lazy", factory).data.size(), 8u);
+    EXPECT_EQ(dict.GetOrInsert("lazy", factory).data.size(), 8u);
+    EXPECT_EQ(factory_calls, 1);
+
+    for (int i = 0; i < 3; i++)
+        dict.Upsert("counter", [](E &e) { e.data.push_back(1); });
+    EXPECT_EQ(dict.Get("counter").data.size(), 3u);
+    EXPECT_EQ(E::copies, 0);
+}
+
+TEST(tree_testing, slab_allocator){
+    TreeDictionary<string, string, std::less<string>, SlabNodeAllocator<16>> string_dict;
+    for (int i = 0; i < 1000; i++)
+        string_dict.Set(to_string(i), string(100, 'a'));
+    for (int i = 0; i < 1000; i += 2)
+        string_dict.Erase(to_string(i));
+    for (int i = 0; i < 1000; i++)
+        string_dict.Set(to_string(i), to_string(-i));
+    for (int i = 0; i < 1000; i++)
+        EXPECT_EQ(string_dict.Get(to_string(i)), to_string(-i));
+}
+
+TEST(tree_testing, ordered_iteration){
+    TreeDictionary<int, int> int_dict;
+    const int MAX_VAlUES = 100000;
+    std::vector<int> values(MAX_VAlUES);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        values[i] = 2 * i;
+
+    EXPECT_TRUE(int_dict.begin() == int_dict.end());
+    std::random_shuffle(values.begin(), values.end());
+    for (int i = 0; i < MAX_VAlUES; i++)
+        int_dict.Set(values[i], -values[i]);
+    for (int i = 0; i < MAX_VAlUES; i += 3)
+        int_dict.Erase(values[i]);
+    int_dict.EraseIf([](const int &key, const int &) { return key % 10 == 0; });
+
+    std::vector<int> expected;
+    for (int i = 1; i < MAX_VAlUES; i++)
+        if (int_dict.IsSet(2 * i))
+            expected.push_back(2 * i);
+
+    std::vector<int> forward;
+    for (auto entry : int_dict) {
+        EXPECT_EQ(entry.second, -entry.first);
+        forward.push_back(entry.first);
+    }
+    EXPECT_EQ(forward, expected);
+
+    std::vector<int> backward;
+    for (auto it = int_dict.rbegin(); it != int_dict.rend(); ++it)
+        backward.push_back((*it).first);
+    std::reverse(backward.begin(), backward.end());
+    EXPECT_EQ(backward, expected);
+
+    for (int key = -1; key < 2 * MAX_VAlUES + 1; key += 7) {
+        auto lower = std::lower_bound(expected.begin(), expected.end(), key);
+        auto upper = std::upper_bound(expected.begin(), expected.end(), key);
+        if (lower == expected.end())
+            EXPECT_TRUE(int_dict.LowerBound(key) == int_dict.end());
+        else
+            EXPECT_EQ(int_dict.LowerBound(key).Key(), *lower);
+        if (upper == expected.end())
+            EXPECT_TRUE(int_dict.UpperBound(key) == int_dict.end());
+        else
+            EXPECT_EQ(int_dict.UpperBound(key).Key(), *upper);
+    }
+
+    std::vector<int> range;
+    int_dict.ForEachInRange(1000, 5001, [&range](const int &key, const int &value) {
+        EXPECT_EQ(value, -key);
+        range.push_back(key);
+    });
+    EXPECT_EQ(range, std::vector<int>(std::lower_bound(expected.begin(), expected.end(), 1000),
+                                      std::lower_bound(expected.begin(), expected.end(), 5001)));
+    int calls = 0;
+    int_dict.ForEachInRange(5001, 1000, [&calls](const int &, const int &) { calls++; });
+    EXPECT_EQ(calls, 0);
+}
+
+//a (key, value) pair read from a stream, for single pass iterators
+struct StreamPair : std::pair<int, int> {
+    friend std::istream &operator>>(std::istream &in, StreamPair &entry) {
+        return in >> entry.first >> entry.second;
+    }
+};
+
+TEST(tree_testing, bulk_build){
+    const int MAX_VAlUES = 200000;
+    std::vector<std::pair<int, int>> sorted;
+    for (int i = 0; i < MAX_VAlUES; i++) {
+        sorted.emplace_back(2 * i, 1);
+        if (i % 5 == 0)
+            sorted.emplace_back(2 * i, 2 * i);
+    }
+
+    TreeDictionary<int, int> int_dict;
+    int_dict.Set(-1, -1);
+    int_dict.BuildFromSorted(sorted.begin(), sorted.end());
+    EXPECT_FALSE(int_dict.IsSet(-1));
+    for (int i = 0; i < MAX_VAlUES; i++) {
+        EXPECT_EQ(int_dict.Get(2 * i), i % 5 == 0 ? 2 * i : 1);
+        EXPECT_FALSE(int_dict.IsSet(2 * i + 1));
+    }
+
+    std::vector<std::pair<int, int>> batch;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        batch.emplace_back(3 * i, -3 * i);
+    std::random_shuffle(batch.begin(), batch.end());
+    batch.emplace_back(0, 7);
+    int_dict.BulkInsert(batch.begin(), batch.end());
+    int_dict.BulkInsert(batch.begin(), batch.begin() + 10);
+
+    int previous = -1;
+    for (auto entry : int_dict) {
+        EXPECT_LT(previous, entry.first);
+        previous = entry.first;
+        if (entry.first == 0)
+            EXPECT_EQ(entry.second, 7);
+        else if (entry.first % 3 == 0)
+            EXPECT_EQ(entry.second, -entry.first);
+        else
+            EXPECT_EQ(entry.second, entry.first % 10 == 0 ? entry.first : 1);
+    }
+    for (int i = 0; i < 3 * MAX_VAlUES; i += 6)
+        EXPECT_TRUE(int_dict.Erase(i));
+    EXPECT_FALSE(int_dict.IsSet(6));
+    EXPECT_TRUE(int_dict.IsSet(3));
+
+    TreeDictionary<string, int, std::less<string>, SlabNodeAllocator<>> string_dict;
+    std::vector<std::pair<string, int>> unsorted = {{"b", 1}, {"a", 2}, {"c", 3}, {"a", 4}};
+    string_dict.BuildFromSorted(unsorted.begin(), unsorted.end());
+    EXPECT_EQ(string_dict.Get("a"), 4);
+    EXPECT_EQ(string_dict.Get("c"), 3);
+    EXPECT_EQ(string_dict.begin().Key(), "a");
+
+    std::istringstream stream("1 10 2 20 2 21 5 50");
+    TreeDictionary<int, int> stream_dict;
+    stream_dict.BuildFromSorted(std::istream_iterator<StreamPair>(stream), std::istream_iterator<StreamPair>());
+    std::vector<std::pair<int, int>> built(stream_dict.begin(), stream_dict.end());
+    EXPECT_EQ(built, (std::vector<std::pair<int, int>>{{1, 10}, {2, 21}, {5, 50}}));
+}
+
+TEST(tree_testing, update_in_place){
+    TreeDictionary<int, int> int_dict;
+    const int MAX_VAlUES = 100000;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        int_dict.Set(i, i);
+
+    std::vector<const int *> places(MAX_VAlUES);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        places[i] = int_dict.TryGet(i);
+    for (int round = 1; round < 5; round++)
+        for (int i = 0; i < MAX_VAlUES; i++)
+            int_dict.Set(i, i * round);
+    for (int i = 0; i < MAX_VAlUES; i++) {
+        EXPECT_EQ(int_dict.TryGet(i), places[i]);
+        EXPECT_EQ(*places[i], i * 4);
+    }
+
+    for (int i = MAX_VAlUES; i > 0; i--)
+        int_dict.Set(-i, -i);
+    int previous = -MAX_VAlUES - 1;
+    for (auto entry : int_dict) {
+        EXPECT_EQ(previous + 1, entry.first);
+        previous = entry.first;
+    }
+}
+
+TEST(tree_testing, freeze){
+    TreeDictionary<int, int> int_dict;
+    const int MAX_VAlUES = 100000;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        int_dict.Set(3 * i, i);
+
+    FrozenDictionary<int, int> frozen = int_dict.Freeze();
+    int_dict.Set(1, 1);
+    EXPECT_EQ(frozen.Size(), std::size_t(MAX_VAlUES));
+    for (int i = -1; i < 3 * MAX_VAlUES + 1; i++) {
+        if (i % 3 == 0 && i >= 0 && i < 3 * MAX_VAlUES)
+            EXPECT_EQ(frozen.Get(i), i / 3);
+        else
+            EXPECT_FALSE(frozen.IsSet(i));
+    }
+    EXPECT_THROW(frozen.Get(1), DictionaryNotFoundException<int>);
+    EXPECT_EQ(frozen.Get<DefaultOnMiss>(1), 0);
+
+    for (int size = 0; size < 40; size++) {
+        std::vector<std::pair<string, int>> entries;
+        for (int i = 0; i < size; i++)
+            entries.emplace_back(to_string(i), i);
+        entries.emplace_back("5", -5);
+        FrozenDictionary<string, int, ThreeWayCompare> string_frozen(entries.begin(), entries.end());
+        EXPECT_EQ(string_frozen.Size(), std::size_t(size > 5 ? size : size + 1));
+        for (int i = 0; i < size; i++)
+            EXPECT_EQ(*string_frozen.TryGet(std::string_view(to_string(i))), i == 5 ? -5 : i);
+        EXPECT_EQ(string_frozen.TryGet(std::string_view("")), nullptr);
+        EXPECT_FALSE(string_frozen.IsSet("99"));
+    }
+
+    std::istringstream stream("1 10 2 20 2 21 5 50");
+    FrozenDictionary<int, int> stream_frozen((std::istream_iterator<StreamPair>(stream)),
+                                             std::istream_iterator<StreamPair>());
+    EXPECT_EQ(stream_frozen.Size(), 3u);
+    EXPECT_EQ(stream_frozen.Get(2), 21);
+    EXPECT_EQ(stream_frozen.Get(5), 50);
+}
+
+TEST(tree_testing, order_statistics){
+    TreeDictionary<int, int, std::less<int>, HeapNodeAllocator, true> int_dict;
+    const int MAX_VAlUES = 20000;
+    std::vector<int> values(MAX_VAlUES);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        values[i] = 2 * i;
+
+    std::random_shuffle(values.begin(), values.end());
+    for (int i = 0; i < MAX_VAlUES; i++)
+        int_dict.Set(values[i], i);
+    for (int i = 0; i < MAX_VAlUES; i += 4)
+        int_dict.Set(values[i], -i);
+    for (int i = 0; i < MAX_VAlUES; i += 3)
+        int_dict.Erase(values[i]);
+    int_dict.EraseIf([](const int &key, const int &) { return key % 14 == 0; });
+
+    std::vector<int> keys;
+    for (auto entry : int_dict)
+        keys.push_back(entry.first);
+    EXPECT_EQ(int_dict.Size(), keys.size());
+
+    for (std::size_t k = 0; k < keys.size(); k++)
+        EXPECT_EQ(int_dict.Select(k).Key(), keys[k]);
+    EXPECT_TRUE(int_dict.Select(keys.size()) == int_dict.end());
+
+    for (int key = -1; key <= 2 * MAX_VAlUES; key += 5)
+        EXPECT_EQ(int_dict.Rank(key),
+                  static_cast<std::size_t>(std::lower_bound(keys.begin(), keys.end(), key) - keys.begin()));
+    EXPECT_EQ(int_dict.CountInRange(100, 1000),
+              static_cast<std::size_t>(std::lower_bound(keys.begin(), keys.end(), 1000) -
+                                       std::lower_bound(keys.begin(), keys.end(), 100)));
+    EXPECT_EQ(int_dict.CountInRange(1000, 100), 0u);
+
+    std::vector<std::pair<int, int>> batch;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        batch.emplace_back(2 * i + 1, i);
+    int_dict.BulkInsert(batch.begin(), batch.end());
+    EXPECT_EQ(int_dict.Size(), keys.size() + std::size_t(MAX_VAlUES));
+    EXPECT_EQ(int_dict.Select(0).Key(), 1);
+    int_dict.BuildFromSorted(batch.begin(), batch.end());
+    EXPECT_EQ(int_dict.Rank(2 * MAX_VAlUES), std::size_t(MAX_VAlUES));
+}
+
+typedef TreeDictionary<int, int, std::less<int>, HeapNodeAllocator, true> CountedTree;
+
+//keys from, from + step, ... up to to, each with value -key
+void check_tree_order(const CountedTree &dict, int from, int to, int step) {
+    int expected = from;
+    for (auto entry : dict) {
+        EXPECT_EQ(entry.first, expected);
+        EXPECT_EQ(entry.second, -entry.first);
+        expected += step;
+    }
+    EXPECT_EQ(expected, to);
+}
+
+TEST(tree_testing, split_join_merge){
+    const int MAX_VAlUES = 50000;
+    CountedTree left, right;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        left.Set(i, -i);
+
+    for (int key = MAX_VAlUES; key >= 0; key -= 7919) {
+        left.Split(key, right);
+        check_tree_order(left, 0, key, 1);
+        check_tree_order(right, key, MAX_VAlUES, 1);
+        EXPECT_EQ(left.Size(), std::size_t(key));
+        EXPECT_EQ(right.Size(), std::size_t(MAX_VAlUES - key));
+
+        left.Join(right);
+        EXPECT_EQ(right.begin(), right.end());
+        check_tree_order(left, 0, MAX_VAlUES, 1);
+        EXPECT_EQ(left.Rank(key), std::size_t(key));
+    }
+    left.Split(MAX_VAlUES / 2, right);
+    right.Join(left);
+    check_tree_order(right, 0, MAX_VAlUES, 1);
+    for (int i = 0; i < MAX_VAlUES; i += 2)
+        EXPECT_TRUE(right.Erase(i));
+    EXPECT_EQ(right.Select(0).Key(), 1);
+
+    CountedTree evens;
+    for (int i = 0; i < MAX_VAlUES; i += 2)
+        evens.Set(i, 0);
+    evens.Set(1, 0);
+    right.Merge(evens);
+    EXPECT_EQ(evens.begin(), evens.end());
+    EXPECT_EQ(right.Get(1), 0);
+    right.Set(1, -1);
+    right.EraseIf([](const int &, const int &value) { return value == 0; });
+    check_tree_order(right, 1, MAX_VAlUES + 1, 2);
+
+    TreeDictionary<int, int, std::less<int>, SlabNodeAllocator<>> slab_left, slab_right;
+    for (int i = 0; i < 1000; i++)
+        (i % 2 == 0 ? slab_left : slab_right).Set(i, -i);
+    slab_left.Merge(slab_right);
+    slab_right.Set(5, 5);
+    int expected = 0;
+    for (auto entry : slab_left) {
+        EXPECT_EQ(entry.first, expected);
+        EXPECT_EQ(entry.second, -expected++);
+    }
+    EXPECT_EQ(expected, 1000);
+    EXPECT_EQ(slab_right.Get(5), 5);
+}
+
+TEST(tree_testing, persistent_snapshots){
+    PersistentTreeDictionary<int, int> int_dict;
+    for (int i = 0; i < 20000; i++)
+        int_dict.Set(i, i);
+    for (int i = 1; i < 20000; i += 2)
+        EXPECT_TRUE(int_dict.Erase(i));
+    EXPECT_FALSE(int_dict.Erase(1));
+    EXPECT_EQ(int_dict.EraseIf([](const int &key, const int &) { return key % 4 == 0; }), 5000u);
+    EXPECT_EQ(int_dict.Size(), 5000u);
+    EXPECT_EQ(int_dict.Get(19998), 19998);
+
+    PersistentTreeDictionary<string, int> live;
+    const int MAX_VAlUES = 10000;
+    std::vector<PersistentTreeDictionary<string, int>> versions;
+    for (int round = 0; round < 4; round++) {
+        versions.push_back(live.Snapshot());
+        for (int i = 0; i < MAX_VAlUES; i++)
+            live.Set(to_string(i), round * MAX_VAlUES + i);
+        for (int i = round; i < MAX_VAlUES; i += 4)
+            live.Erase(to_string(i));
+    }
+    live.EraseIf([](const string &key, const int &) { return key.size() < 4; });
+
+    EXPECT_EQ(versions[0].Size(), 0u);
+    for (int round = 1; round < 4; round++) {
+        EXPECT_EQ(versions[round].Size(), std::size_t(MAX_VAlUES - MAX_VAlUES / 4));
+        for (int i = 0; i < MAX_VAlUES; i++) {
+            if (i % 4 == round - 1)
+                EXPECT_FALSE(versions[round].IsSet(to_string(i)));
+            else
+                EXPECT_EQ(versions[round].Get(to_string(i)), (round - 1) * MAX_VAlUES + i);
+        }
+    }
+    EXPECT_EQ(live.Size(), std::size_t(MAX_VAlUES - 1000 - (MAX_VAlUES - 1000) / 4));
+    EXPECT_EQ(live.Get("1001"), 3 * MAX_VAlUES + 1001);
+    EXPECT_FALSE(live.IsSet("1003"));
+
+    //nodes shared with a snapshot are copied once, then they belong to the live version and change in place
+    PersistentTreeDictionary<string, E> values;
+    for (int i = 0; i < 100; i++)
+        values.Set(to_string(i), E(1));
+    E::copies = 0;
+    PersistentTreeDictionary<string, E> before = values.Snapshot();
+    values.Upsert("50", [](E &e) { e.data.push_back(1); });
+    int path_copies = E::copies;
+    EXPECT_GT(path_copies, 0);
+    values.Upsert("50", [](E &e) { e.data.push_back(1); });
+    EXPECT_EQ(E::copies, path_copies);
+    EXPECT_EQ(before.Get("50").data.size(), 1u);
+    EXPECT_EQ(values.Get("50").data.size(), 3u);
+    EXPECT_TRUE(values.Erase("50"));
+    EXPECT_TRUE(before.IsSet("50"));
+}
+
+TEST(tree_testing, compact_layout){
+    CompactTreeDictionary<int, int> int_dict;
+    for (int i = 0; i < 100000; i++)
+        int_dict.Set(i, i);
+    for (int i = 1; i < 100000; i += 2)
+        EXPECT_TRUE(int_dict.Erase(i));
+    EXPECT_FALSE(int_dict.Erase(1));
+    EXPECT_EQ(int_dict.EraseIf([](const int &key, const int &) { return key % 4 == 0; }), 25000u);
+    EXPECT_EQ(int_dict.Size(), 25000u);
+    for (int i = 0; i < 100000; i++)
+        int_dict.Set(i, -i);
+    for (int i = 0; i < 100000; i++)
+        EXPECT_EQ(int_dict.Get(i), -i);
+    EXPECT_EQ(int_dict.Size(), 100000u);
+
+    for (int i = 0; i < 100000; i += 3)
+        EXPECT_TRUE(int_dict.Erase(i));
+    int_dict.Rebuild();
+    for (int i = 0; i < 100000; i++)
+        EXPECT_EQ(int_dict.IsSet(i), i % 3 != 0);
+
+    CompactTreeDictionary<string, string> string_dict;
+    std::vector<int> values(20000);
+    for (int i = 0; i < 20000; i++)
+        values[i] = i;
+    std::random_shuffle(values.begin(), values.end());
+    for (int i = 0; i < 20000; i++)
+        string_dict.Set(to_string(values[i]), string(20, 'a' + values[i] % 26));
+    std::random_shuffle(values.begin(), values.end());
+    for (int i = 0; i < 10000; i++)
+        EXPECT_TRUE(string_dict.Erase(to_string(values[i])));
+    for (int i = 10000; i < 20000; i++)
+        EXPECT_EQ(string_dict.Get(to_string(values[i])), string(20, 'a' + values[i] % 26));
+    EXPECT_THROW(string_dict.Get(to_string(values[0])), DictionaryNotFoundException<string>);
+
+    //mixed Set forms copy only their const half
+    CompactTreeDictionary<string, E> move_dict;
+    const string key = "key";
+    const E value(2);
+    E::copies = 0;
+    move_dict.Set(key, E(3));
+    move_dict.Set(key, E(4));
+    EXPECT_EQ(E::copies, 0);
+    move_dict.Set(string("other"), value);
+    EXPECT_EQ(E::copies, 1);
+    EXPECT_EQ(move_dict.Get("key").data.size(), 4u);
+    EXPECT_EQ(move_dict.Get("other").data.size(), 2u);
+
+    //in place insertion builds the node once, also when the vector grows under it
+    E::copies = 0;
+    for (int i = 0; i < 1000; i++)
+        EXPECT_TRUE(move_dict.TryEmplace(to_string(i), i % 5));
+    EXPECT_FALSE(move_dict.TryEmplace("7", 9));
+    EXPECT_EQ(move_dict.Get("7").data.size(), 2u);
+    int factory_calls = 0;
+    auto factory = [&factory_calls]() {
+        factory_calls++;
+        return E(6);
+    };
+    move_dict.GetOrInsert("lazy", factory).data.push_back(1);
+    EXPECT_EQ(move_dict.GetOrInsert("lazy", factory).data.size(), 7u);
+    EXPECT_EQ(move_dict.GetOrInsert("8", factory).data.size(), 3u);
+    EXPECT_EQ(factory_calls, 1);
+    for (int i = 0; i < 1000; i += 3)
+        move_dict.Upsert(to_string(i), [](E &e) { e.data.push_back(1); });
+    move_dict.Upsert("new", [](E &e) { e.data.push_back(1); });
+    for (int i = 0; i < 1000; i++)
+        EXPECT_EQ(move_dict.Get(to_string(i)).data.size(), std::size_t(i % 5 + (i % 3 == 0)));
+    EXPECT_EQ(move_dict.Get("new").data.size(), 1u);
+    EXPECT_EQ(move_dict.Size(), 1004u);
+    EXPECT_EQ(E::copies, 0);
+}
+
+//key without "<" and "==", ordered only by a three-way comparator
+struct F {
+    int a, b;
+};
+
+struct FCompare {
+    static int calls;
+
+    int operator()(const F &x, const F &y) const {
+        calls++;
+        if (x.a != y.a)
+            return x.a < y.a ? -1 : 1;
+        return x.b < y.b ? -1 : (x.b > y.b ? 1 : 0);
+    }
+};
+
+int FCompare::calls = 0;
+
+TEST(tree_testing, three_way_compare){
+    TreeDictionary<F, int, FCompare> f_dict;
+    const int MAX_VAlUES = 1 << 14;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        f_dict.Set(F{i % 128, i / 128}, i);
+
+    FCompare::calls = 0;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(f_dict.Get(F{i % 128, i / 128}), i);
+    //one call per level of an AVL tree of height below 1.45 * log2(n)
+    EXPECT_LT(FCompare::calls, MAX_VAlUES * 21);
+    EXPECT_FALSE(f_dict.IsSet(F{128, 0}));
+    EXPECT_TRUE(f_dict.Erase(F{0, 0}));
+    EXPECT_EQ(f_dict.begin().Value(), 128);
+
+    TreeDictionary<string, int, ThreeWayCompare> string_dict;
+    for (int i = 0; i < 10000; i++)
+        string_dict.Set(to_string(i), i);
+    for (int i = 0; i < 10000; i++)
+        EXPECT_EQ(string_dict.Get(to_string(i)), i);
+    EXPECT_EQ(string_dict.Get(std::string_view("9999")), 9999);
+    EXPECT_FALSE(string_dict.IsSet(std::string_view("10000")));
+    EXPECT_EQ(string_dict.LowerBound("9998a").Key(), "9999");
+
+    std::vector<string> keys;
+    string_dict.ForEachInRange("10", "11", [&keys](const string &key, const int &) { keys.push_back(key); });
+    EXPECT_EQ(keys.size(), 111u);
+    EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+}
+
+TEST(list_testing, slab_allocator){
+    ListDictionary<string, string, std::equal_to<string>, SlabNodeAllocator<16>> string_dict;
+    for (int i = 0; i < 100; i++)
+        string_dict.Set(to_string(i), string(100, 'a'));
+    string_dict.EraseIf([](const string &key, const string &) { return key.size() == 1; });
+    EXPECT_FALSE(string_dict.IsSet("5"));
+    EXPECT_EQ(string_dict.Get("55"), string(100, 'a'));
+}
+
+//erasing nodes the reorder policies have just moved: the head, a swapped pair and the most counted node
+TEST(list_testing, erase){
+    ListDictionary<int, int> static_dict;
+    for (int i = 0; i < 100; i++)
+        static_dict.Set(i, i);
+    EXPECT_TRUE(static_dict.Erase(99));
+    EXPECT_TRUE(static_dict.Erase(0));
+    EXPECT_TRUE(static_dict.Erase(50));
+    EXPECT_FALSE(static_dict.Erase(50));
+    EXPECT_EQ(static_dict.EraseIf([](const int &key, const int &) { return key % 2 == 0; }), 48u);
+    for (int i = 0; i < 100; i++)
+        EXPECT_EQ(static_dict.IsSet(i), i % 2 == 1 && i != 99);
+
+    ListDictionary<int, int, std::equal_to<int>, HeapNodeAllocator, MoveToFront> front_dict;
+    for (int i = 0; i < 100; i++)
+        front_dict.Set(i, i);
+    EXPECT_EQ(*front_dict.Find(0), 0);
+    EXPECT_TRUE(front_dict.Erase(0));
+    EXPECT_EQ(*front_dict.Find(1), 1);
+    EXPECT_EQ(*front_dict.Find(2), 2);
+    EXPECT_TRUE(front_dict.Erase(1));
+    EXPECT_EQ(*front_dict.Find(2), 2);
+    EXPECT_EQ(*front_dict.Find(99), 99);
+    EXPECT_FALSE(front_dict.IsSet(0));
+    EXPECT_FALSE(front_dict.IsSet(1));
+
+    ListDictionary<int, int, std::equal_to<int>, HeapNodeAllocator, Transpose> transpose_dict;
+    for (int i = 0; i < 10; i++)
+        transpose_dict.Set(i, i);
+    for (int i = 0; i < 5; i++)
+        EXPECT_EQ(*transpose_dict.Find(9), 9);
+    EXPECT_TRUE(transpose_dict.Erase(8));
+    EXPECT_TRUE(transpose_dict.Erase(9));
+    transpose_dict.Set(10, 10);
+    EXPECT_EQ(*transpose_dict.Find(10), 10);
+    EXPECT_EQ(*transpose_dict.Find(7), 7);
+    EXPECT_EQ(transpose_dict.EraseIf([](const int &key, const int &) { return key > 5; }), 3u);
+    EXPECT_EQ(*transpose_dict.Find(5), 5);
+
+    ListDictionary<int, int, std::equal_to<int>, HeapNodeAllocator, CountOrder> count_dict;
+    for (int i = 0; i < 10; i++)
+        count_dict.Set(i, i);
+    for (int i = 0; i < 3; i++)
+        EXPECT_EQ(*count_dict.Find(5), 5);
+    EXPECT_EQ(*count_dict.Find(6), 6);
+    EXPECT_TRUE(count_dict.Erase(5));
+    EXPECT_EQ(*count_dict.Find(7), 7);
+    EXPECT_EQ(*count_dict.Find(7), 7);
+    EXPECT_TRUE(count_dict.Erase(6));
+    count_dict.Set(5, -5);
+    for (int i = 0; i < 10; i++)
+        if (i == 6)
+            EXPECT_FALSE(count_dict.IsSet(i));
+        else
+            EXPECT_EQ(count_dict.Get(i), i == 5 ? -5 : i);
+}
+
+//key comparison counter, measures the scan lengths of list dictionaries
+struct CountingEqual {
+    static std::size_t calls;
+
+    bool operator()(int a, int b) const {
+        calls++;
+        return a == b;
+    }
+};
+
+std::size_t CountingEqual::calls = 0;
+
+//average comparisons per lookup under a Zipf (s = 1) workload over keys inserted in random order,
+//int_dict must compare keys with CountingEqual; lookups go through the reordering Find
+template<class Dict>
+double zipf_scan_length(Dict &int_dict, int keys, int lookups) {
+    std::vector<int> order(keys);
+    for (int i = 0; i < keys; i++)
+        order[i] = i;
+    std::mt19937 gen(17);
+    std::shuffle(order.begin(), order.end(), gen);
+    for (int key : order)
+        int_dict.Set(key, key);
+
+    std::vector<double> weights(keys);
+    for (int i = 0; i < keys; i++)
+        weights[i] = 1.0 / (i + 1);
+    std::discrete_distribution<int> zipf(weights.begin(), weights.end());
+    CountingEqual::calls = 0;
+    for (int i = 0; i < lookups; i++) {
+        int key = zipf(gen);
+        if (*int_dict.Find(key) != key)
+            ADD_FAILURE();
+    }
+    return double(CountingEqual::calls) / lookups;
+}
+
+//access cost test: every policy must beat the insertion order by a margin that holds for any seed;
+//a Zipf workload over 1000 keys scans ~500 keys in random order, ~134 in the best one
+TEST(list_testing, reorder_policies) {
+    const int KEYS = 1000, LOOKUPS = 100000;
+    ListDictionary<int, int, CountingEqual> static_dict;
+    double static_order = zipf_scan_length(static_dict, KEYS, LOOKUPS);
+    ListDictionary<int, int, CountingEqual, HeapNodeAllocator, MoveToFront> move_to_front_dict;
+    double move_to_front = zipf_scan_length(move_to_front_dict, KEYS, LOOKUPS);
+    ListDictionary<int, int, CountingEqual, HeapNodeAllocator, Transpose> transpose_dict;
+    double transpose = zipf_scan_length(transpose_dict, KEYS, LOOKUPS);
+    ListDictionary<int, int, CountingEqual, HeapNodeAllocator, CountOrder> count_dict;
+    double count_order = zipf_scan_length(count_dict, KEYS, LOOKUPS);
+    EXPECT_LT(move_to_front, static_order / 2);
+    EXPECT_LT(transpose, static_order);
+    EXPECT_LT(count_order, static_order / 2);
+
+    //const lookups leave the order as it is: the last key costs a full scan every time
+    ListDictionary<int, int, CountingEqual, HeapNodeAllocator, MoveToFront> const_dict;
+    for (int i = 0; i < 100; i++)
+        const_dict.Set(i, i);
+    const auto &view = const_dict;
+    CountingEqual::calls = 0;
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(view.Get(0), 0);
+        EXPECT_TRUE(view.IsSet(0));
+        EXPECT_EQ(*view.TryGet(0), 0);
+    }
+    EXPECT_EQ(CountingEqual::calls, 3u * 10 * 100);
+    EXPECT_EQ(*const_dict.Find(0), 0);
+    CountingEqual::calls = 0;
+    EXPECT_EQ(view.Get(0), 0);
+    EXPECT_EQ(CountingEqual::calls, 1u);
+    EXPECT_EQ(const_dict.Find(100), nullptr);
+}
+
+enum class Color : std::uint8_t {
+    RED, GREEN, BLUE
+};
+
+//trivially copyable key without a default constructor
+struct Ticket {
+    int id;
+
+    explicit Ticket(int id_)
+            : id(id_) {}
+
+    bool operator<(const Ticket &other) const {
+        return id < other.id;
+    }
+
+    bool operator==(const Ticket &other) const {
+        return id == other.id;
+    }
+};
+
+//"==" of Ticket compares its only member, so its bytes may be compared directly
+template<>
+struct is_bytewise_equal<Ticket, std::equal_to<Ticket>> : std::true_type {
+};
+
+TEST(list_testing, unrolled) {
+    const int MAX_VAlUES = 20000;
+    std::vector<int> values(MAX_VAlUES);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        values[i] = i;
+    std::random_shuffle(values.begin(), values.end());
+
+    UnrolledListDictionary<long long, int> wide_dict;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        wide_dict.Set(values[i], values[i]);
+    for (int i = MAX_VAlUES - 1; i >= 0; i--)
+        EXPECT_EQ(values[i], wide_dict.Get(values[i]));
+    EXPECT_FALSE(wide_dict.IsSet(MAX_VAlUES));
+    EXPECT_EQ(wide_dict.Size(), std::size_t(MAX_VAlUES));
+    UnrolledListDictionary<short, int> short_dict;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        short_dict.Set(values[i], values[i]);
+    for (int i = MAX_VAlUES - 1; i >= 0; i--)
+        EXPECT_EQ(values[i], short_dict.Get(values[i]));
+    EXPECT_FALSE(short_dict.IsSet(MAX_VAlUES));
+    EXPECT_EQ(short_dict.Size(), std::size_t(MAX_VAlUES));
+    UnrolledListDictionary<int, int, CountingEqual> block_dict;
+    for (int i = 0; i < MAX_VAlUES; i++)
+        block_dict.Set(values[i], values[i]);
+    for (int i = MAX_VAlUES - 1; i >= 0; i--)
+        EXPECT_EQ(values[i], block_dict.Get(values[i]));
+    EXPECT_FALSE(block_dict.IsSet(MAX_VAlUES));
+    EXPECT_EQ(block_dict.Size(), std::size_t(MAX_VAlUES));
+    for (int i = 1; i < MAX_VAlUES; i += 2)
+        EXPECT_TRUE(block_dict.Erase(i));
+    EXPECT_EQ(block_dict.EraseIf([](const int &key, const int &) { return key % 4 == 0; }),
+              std::size_t(MAX_VAlUES / 4));
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(block_dict.IsSet(i), i % 4 == 2);
+
+    UnrolledListDictionary<char, int> char_dict;
+    for (int i = 0; i < 100; i++)
+        char_dict.Set(char(i), i);
+    EXPECT_EQ(char_dict.Get(char(99)), 99);
+    EXPECT_FALSE(char_dict.IsSet(char(100)));
+
+    UnrolledListDictionary<bool, bool> bool_dict;
+    bool_dict.Set(false, true);
+    EXPECT_TRUE(bool_dict.Get(false));
+    EXPECT_THROW(bool_dict.Get(true), DictionaryNotFoundException<bool>);
+
+    UnrolledListDictionary<Color, int> color_dict;
+    color_dict.Set(Color::BLUE, 3);
+    EXPECT_EQ(color_dict.Get(Color::BLUE), 3);
+    EXPECT_FALSE(color_dict.IsSet(Color::RED));
+
+    int numbers[40];
+    UnrolledListDictionary<const int *, int> pointer_dict;
+    for (int i = 0; i < 40; i++)
+        pointer_dict.Set(numbers + i, i);
+    EXPECT_EQ(pointer_dict.Get(numbers + 37), 37);
+    EXPECT_TRUE(pointer_dict.Erase(numbers + 37));
+    EXPECT_FALSE(pointer_dict.IsSet(numbers + 37));
+    EXPECT_EQ(pointer_dict.Get(numbers + 39), 39);
+
+    //std::equal_to<> keeps the byte scan for int keys, other key types are compared through it
+    UnrolledListDictionary<int, E, std::equal_to<>> transparent_dict;
+    E::copies = 0;
+    for (int i = 0; i < 100; i++)
+        transparent_dict.Set(i * 1, E(i % 7));
+    EXPECT_EQ(E::copies, 0);
+    EXPECT_EQ(transparent_dict.Get(44LL).data.size(), 2u);
+    EXPECT_EQ(transparent_dict.TryGet(100LL), nullptr);
+    EXPECT_TRUE(transparent_dict.IsSet(99LL));
+    EXPECT_TRUE(transparent_dict.Erase(99));
+    EXPECT_FALSE(transparent_dict.Erase(99));
+    EXPECT_THROW(transparent_dict.Get(-1LL), DictionaryNotFoundException<int>);
+    EXPECT_EQ(transparent_dict.Size(), 99u);
+
+    UnrolledListDictionary<Ticket, int> ticket_dict;
+    UnrolledListDictionary<Ticket, int, std::equal_to<>> block_ticket_dict;
+    for (int i = 0; i < 100; i++) {
+        ticket_dict.Set(Ticket(i), i);
+        block_ticket_dict.Set(Ticket(i), i);
+    }
+    EXPECT_EQ(ticket_dict.Get(Ticket(77)), 77);
+    EXPECT_TRUE(ticket_dict.Erase(Ticket(0)));
+    EXPECT_FALSE(ticket_dict.IsSet(Ticket(0)));
+    EXPECT_THROW(ticket_dict.Get(Ticket(100)), DictionaryNotFoundException<Ticket>);
+    EXPECT_EQ(block_ticket_dict.Get(Ticket(77)), 77);
+    EXPECT_FALSE(block_ticket_dict.IsSet(Ticket(100)));
+
+    UnrolledListDictionary<long double, int> double_dict;
+    double_dict.Set(123456789.0, 1);
+    EXPECT_EQ(double_dict.Get(123456789.0), 1);
+    EXPECT_THROW(double_dict.Get(0.0), DictionaryNotFoundException<long double>);
+
+    UnrolledListDictionary<string, string, std::equal_to<>> string_dict;
+    for (int i = 0; i < 100; i++)
+        string_dict.Set(to_string(i), string(100, 'a' + i % 26));
+    EXPECT_EQ(string_dict.Get(std::string_view("27")), string(100, 'b'));
+    EXPECT_EQ(string_dict.EraseIf([](const string &key, const string &) { return key.size() == 1; }), 10u);
+    EXPECT_FALSE(string_dict.IsSet("5"));
+    EXPECT_EQ(string_dict.Get("55"), string(100, 'd'));
+    EXPECT_EQ(string_dict.Size(), 90u);
+    EXPECT_TRUE(string_dict.Erase("55"));
+    EXPECT_FALSE(string_dict.IsSet("55"));
+    string_dict.Upsert("x", [](string &value) { value += "y"; });
+    EXPECT_EQ(string_dict.Get("x"), "y");
+}
+
+//counts live instances, moves throw while armed
+struct ThrowingMove {
+    int val;
+    static bool armed;
+    static int live;
+
+    explicit ThrowingMove(int v) : val(v) {
+        live++;
+    }
+
+    ThrowingMove(const ThrowingMove &other) : val(other.val) {
+        live++;
+    }
+
+    ThrowingMove(ThrowingMove &&other) : val(other.val) {
+        if (armed)
+            throw std::runtime_error("move");
+        live++;
+    }
+
+    ThrowingMove &operator=(const ThrowingMove &other) = default;
+
+    ThrowingMove &operator=(ThrowingMove &&other) {
+        if (armed)
+            throw std::runtime_error("move");
+        val = other.val;
+        return *this;
+    }
+
+    ~ThrowingMove() {
+        live--;
+    }
+};
+bool ThrowingMove::armed = false;
+int ThrowingMove::live = 0;
+
+TEST(list_testing, unrolled_throwing_erase) {
+    {
+        UnrolledListDictionary<string, ThrowingMove> dict;
+        for (int i = 0; i < 100; i++)
+            dict.Set(to_string(i), ThrowingMove(i));
+        EXPECT_EQ(ThrowingMove::live, 100);
+        ThrowingMove::armed = true;
+        EXPECT_THROW(dict.Erase("3"), std::runtime_error);
+        EXPECT_THROW(dict.EraseIf([](const string &, const ThrowingMove &) { return true; }), std::runtime_error);
+        ThrowingMove::armed = false;
+        EXPECT_EQ(dict.Size(), 100u);
+        EXPECT_EQ(ThrowingMove::live, 100);
+        //the last entry needs no move
+        EXPECT_TRUE(dict.Erase("99"));
+        EXPECT_EQ(ThrowingMove::live, 99);
+    }
+    EXPECT_EQ(ThrowingMove::live, 0);
+}
+
+TEST(btree_testing, touch_diff_types) {
+    BTreeDictionary<char, int> char_dict;
+    char_dict.Set('0', 1);
+    EXPECT_EQ(char_dict.Get('0'), 1);
+    EXPECT_FALSE(char_dict.IsSet('1'));
+
+    BTreeDictionary<bool, int> bool_dict;
+    bool_dict.Set(false, 1);
+    EXPECT_EQ(bool_dict.Get(false), 1);
+    EXPECT_THROW(bool_dict.Get(true), DictionaryNotFoundException<bool>);
+
+    BTreeDictionary<B, B> B_dict;
+    B b1(10, 10), b2(20, -1);
+    B_dict.Set(b1, b2);
+    EXPECT_EQ(B_dict.Get(b1), b2);
+    EXPECT_FALSE(B_dict.IsSet(b2));
+
+    BTreeDictionary<string, string> string_dict;
+    for (int i = 0; i < 1000; i++)
+        string_dict.Set(to_string(i), string(50, 'a' + i % 26));
+    for (int i = 0; i < 1000; i++)
+        EXPECT_EQ(string_dict.Get(to_string(i)), string(50, 'a' + i % 26));
+    EXPECT_THROW(string_dict.Get("-1"), DictionaryNotFoundException<string>);
+}
+
+TEST(btree_testing, multiple_values){
+    BTreeDictionary<int, int> int_dict;
+    const int MAX_VAlUES = 500000;
+    std::vector<int> values(MAX_VAlUES);
+    for (int i = 0; i < MAX_VAlUES; i++)
+        values[i] = i;
+
+    std::random_shuffle(values.begin(), values.end());
+
+    for (int i = 0; i < MAX_VAlUES; i++)
+        int_dict.Set(values[i], values[i]);
+
+    std::random_shuffle(values.begin(), values.end());
+
+    for (int i = 0; i < MAX_VAlUES; i++)
+        EXPECT_EQ(values[i], int_dict.Get(values[i]));
+    EXPECT_EQ(int_dict.Size(), std::size_t(MAX_VAlUES));
+}
+
+TEST(btree_testing, erase){
+    BTreeDictionary<int, int> int_dict;
+    for (int i = 0; i < 100000; i++)
+        int_dict.Set(i, i);
+    for (int i = 1; i < 100000; i += 2)
+        EXPECT_TRUE(int_dict.Erase(i));
+    EXPECT_FALSE(int_dict.Erase(1));
+    EXPECT_EQ(int_dict.EraseIf([](const int &key, const int &) { return key % 4 == 0; }), 25000u);
+    for (int i = 0; i < 100000; i++)
+        EXPECT_EQ(int_dict.IsSet(i), i % 4 == 2);
+
+    BTreeDictionary<string, int> string_dict;
+    for (int i = 0; i < 20000; i++)
+        string_dict.Set(to_string(i), i);
+    for (int i = 0; i < 20000; i++)
+        EXPECT_TRUE(string_dict.Erase(to_string(i)));
+    EXPECT_EQ(string_dict.Size(), 0u);
+    EXPECT_FALSE(string_dict.IsSet("0"));
+    string_dict.Set("0", 0);
+    EXPECT_EQ(string_dict.Get("0"), 0);
+}
+
+//a throwing factory leaves the tree as it was, in a leaf with room and in a full one that would split
+TEST(btree_testing, throwing_insert){
+    BTreeDictionary<int, int> int_dict;
+    for (int i = 0; i < 2000; i += 2)
+        int_dict.Set(i, i);
+    auto factory = []() -> int {
+        throw std::runtime_error("factory");
+    };
+    for (int i = 1; i < 2000; i += 2)
+        EXPECT_THROW(int_dict.GetOrInsert(i, factory), std::runtime_error);
+    EXPECT_EQ(int_dict.Size(), 1000u);
+    for (int i = 0; i < 2000; i++)
+        EXPECT_EQ(int_dict.IsSet(i), i % 2 == 0);
+    for (int i = 1; i < 2000; i += 2)
+        int_dict.Set(i, i);
+    for (int i = 0; i < 2000; i++)
+        EXPECT_EQ(int_dict.Get(i), i);
+}
+
+TEST(btree_testing, concurrent){
+    ConcurrentBTreeDictionary<int, string> dict;
+    const int THREADS = 4, PER_THREAD = 50000, HOT = 64;
+    for (int i = 0; i < HOT; i++)
+        dict.Set(-1 - i, string(16, 'a'));
+
+    std::atomic<int> errors(0), writing(THREADS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++)
+        threads.emplace_back([&dict, &errors, &writing, t]() {
+            for (int i = 0; i < PER_THREAD; i++) {
+                int key = i * THREADS + t;
+                dict.Set(key, to_string(key));
+                if (i % 8 == 0)
+                    dict.Set(-1 - i % HOT, string(16, 'a' + (i + t) % 26));
+                if (i % 3 == 0 && !dict.Erase(key))
+                    errors++;
+            }
+            writing--;
+        });
+    for (int t = 0; t < 2; t++)
+        threads.emplace_back([&dict, &errors, &writing, t]() {
+            for (int i = t; writing > 0; i += 7) {
+                string value;
+                int key = i % (THREADS * PER_THREAD);
+                if (dict.TryGet(key, value) && value != to_string(key))
+                    errors++;
+                if (!dict.TryGet(-1 - i % HOT, value) || value != string(16, value[0]))
+                    errors++;
+            }
+        });
+    for (std::thread &thread : threads)
+        thread.join();
+
+    EXPECT_EQ(errors, 0);
+    EXPECT_EQ(dict.Size(), std::size_t(HOT + THREADS * (PER_THREAD - (PER_THREAD + 2) / 3)));
+    for (int key = 0; key < THREADS * PER_THREAD; key++) {
+        if (key / THREADS % 3 == 0)
+            EXPECT_FALSE(dict.IsSet(key));
+        else
+            EXPECT_EQ(dict.Get(key), to_string(key));
+    }
+    EXPECT_THROW(dict.Get(THREADS * PER_THREAD), DictionaryNotFoundException<int>);
+}
+
+//a sliding window of keys empties leaves all the time: they are unlinked and retired while readers
+//and other writers may still pass through them
+TEST(btree_testing, concurrent_churn){
+    ConcurrentBTreeDictionary<int, string> dict;
+    const int THREADS = 4, ROUNDS = 50000, WINDOW = 200;
+    std::atomic<int> errors(0), writing(THREADS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++)
+        threads.emplace_back([&dict, &errors, &writing, t]() {
+            for (int i = 0; i < ROUNDS; i++) {
+                dict.Set(i * THREADS + t, to_string(i * THREADS + t));
+                if (i >= WINDOW && !dict.Erase((i - WINDOW) * THREADS + t))
+                    errors++;
+            }
+            writing--;
+        });
+    for (int t = 0; t < 2; t++)
+        threads.emplace_back([&dict, &errors, &writing, t]() {
+            for (int i = t; writing > 0; i += 13) {
+                string value;
+                int key = i % (THREADS * ROUNDS);
+                if (dict.TryGet(key, value) && value != to_string(key))
+                    errors++;
+            }
+        });
+    for (std::thread &thread : threads)
+        thread.join();
+
+    EXPECT_EQ(errors, 0);
+    EXPECT_EQ(dict.Size(), std::size_t(THREADS * WINDOW));
+    for (int key = 0; key < THREADS * ROUNDS; key++)
+        EXPECT_EQ(dict.IsSet(key), key >= THREADS * (ROUNDS - WINDOW));
+    for (int key = 0; key < THREADS * ROUNDS; key++)
+        dict.Erase(key);
+    EXPECT_EQ(dict.Size(), 0u);
+    dict.Set(1, "1");
+    EXPECT_EQ(dict.Get(1), "1");
+}
+
+//value whose copy waits until all readers copy at once, so every reader holds an epoch slot together
+struct Turnstile {
+    static std::atomic<int> waiting;
+    static int readers;
+    int id;
+
+    explicit Turnstile(int id_)
+            : id(id_) {}
+
+    Turnstile(const Turnstile &other)
+            : id(other.id) {
+        if (readers == 0)
+            return;
+        waiting++;
+        while (waiting < readers)
+            std::this_thread::yield();
+    }
+};
+
+std::atomic<int> Turnstile::waiting(0);
+int Turnstile::readers = 0;
+
+TEST(btree_testing, concurrent_readers){
+    ConcurrentBTreeDictionary<Ticket, Turnstile> dict;
+    const int READERS = 150;
+    for (int i = 0; i < READERS; i++)
+        dict.Set(Ticket(i), Turnstile(i));
+
+    Turnstile::readers = READERS;
+    std::atomic<int> errors(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < READERS; t++)
+        threads.emplace_back([&dict, &errors, t]() {
+            if (dict.Get(Ticket(t)).id != t)
+                errors++;
+        });
+    for (std::thread &thread : threads)
+        thread.join();
+    Turnstile::readers = 0;
+
+    EXPECT_EQ(errors, 0);
+    EXPECT_EQ(Turnstile::waiting, READERS);
+    EXPECT_FALSE(dict.IsSet(Ticket(READERS)));
+    dict.Set(Ticket(0), Turnstile(-1));
+    EXPECT_EQ(dict.Get(Ticket(0)).id, -1);
+}
+
+//value counting its live copies
+struct G {
+    int val;
+    static std::atomic<int> alive;
+
+    explicit G(int v) : val(v) { alive++; }
+
+    G(const G &g) : val(g.val) { alive++; }
+
+    G &operator=(const G &g) = default;
+
+    ~G() { alive--; }
+};
+std::atomic<int> G::alive(0);
+
+//values replaced by threads that have exited are freed by the reclaims of the thread still writing
+TEST(btree_testing, concurrent_exited_threads){
+    const int THREADS = 8, PER_THREAD = 50;
+    {
+        ConcurrentBTreeDictionary<int, G> dict;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < THREADS; t++)
+            threads.emplace_back([&dict, t]() {
+                for (int i = 0; i < PER_THREAD; i++)
+                    dict.Set(t, G(i));
+            });
+        for (std::thread &thread : threads)
+            thread.join();
+        EXPECT_GE(G::alive, THREADS);
+
+        for (int i = 0; i < 1000; i++)
+            dict.Set(THREADS, G(i));
+        EXPECT_EQ(dict.Size(), std::size_t(THREADS + 1));
+        EXPECT_LE(G::alive, THREADS + 1 + 128);
+        EXPECT_EQ(dict.Get(0).val, PER_THREAD - 1);
+        EXPECT_EQ(dict.Get(THREADS).val, 999);
+    }
+    EXPECT_EQ(G::alive, 0);
+}
+
+TEST(cases_testing, best_dictionary) {
+    static_assert(std::is_same<BestDictionary<int, int>, FlatHashDictionary<int, int>>::value, "hash");
+    static_assert(std::is_same<BestDictionary<C, C>, FlatHashDictionary<C, C>>::value, "hash");
+    static_assert(std::is_same<BestDictionary<B, B>, BTreeDictionary<B, B>>::value, "order");
+    static_assert(std::is_same<BestDictionary<B, B, COMPACT_HINT>, CompactTreeDictionary<B, B>>::value, "compact");
+    static_assert(std::is_same<BestDictionary<int, int, ORDERED_HINT>, TreeDictionary<int, int>>::value, "ordered");
+    static_assert(std::is_same<BestDictionary<A, A, LINEAR_HINT>, UnrolledListDictionary<A, A>>::value, "linear");
+    static_assert(!best_engine<A, A, LINEAR_HINT>::IMPLICIT_LINEAR, "silent linear");
+    //BestDictionary<A, A> compiles with a -Wdeprecated-declarations warning (an error under -Werror):
+    //an implicit O(n) choice resolves to the deprecated linear_fallback overload, checked with the warning off
+    static_assert(best_engine<A, A>::ENGINE == DictionaryEngine::LINEAR && best_engine<A, A>::IMPLICIT_LINEAR,
+                  "implicit linear");
+#if defined(__GNUC__) || defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+    static_assert(std::is_same<decltype(linear_fallback(std::bool_constant<best_engine<A, A>::IMPLICIT_LINEAR>())),
+            std::true_type>::value, "deprecated overload");
+#if defined(__GNUC__) || defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+    BestDictionary<int, int> int_dict;
+    for (int i = 0; i < 1000; i++)
+        int_dict.Set(i, i);
+    EXPECT_TRUE(int_dict.Erase(500));
+    EXPECT_FALSE(int_dict.IsSet(500));
+    EXPECT_EQ(int_dict.Get(999), 999);
+
+    BestDictionary<string, int, ORDERED_HINT> string_dict;
+    for (int i = 0; i < 100; i++)
+        string_dict.Set(to_string(i), i);
+    EXPECT_EQ(string_dict.begin().Key(), "0");
+    EXPECT_EQ((*string_dict.rbegin()).first, "99");
+
+    //the compact hint keeps ordered traversal
+    BestDictionary<string, int, ORDERED_HINT | COMPACT_HINT> compact_dict;
+    for (int i = 0; i < 100; i++)
+        compact_dict.Set(to_string(i), i);
+    EXPECT_TRUE(compact_dict.Erase("0"));
+    EXPECT_EQ(compact_dict.begin().Key(), "1");
+    EXPECT_EQ(compact_dict.LowerBound("50a").Key(), "51");
+    EXPECT_EQ((*compact_dict.rbegin()).first, "99");
+
+    BestDictionary<A, A, LINEAR_HINT> A_dict;
+    A a1(10, 10), a2(20, -1);
+    A_dict.Set(a1, a2);
+    EXPECT_EQ(A_dict.Get(a1), a2);
+    EXPECT_THROW(A_dict.Get(a2), DictionaryNotFoundException<A>);
+}
@@ -2,10 +2,38 @@
 #define DICTIONARY_MY_DICTIONARY_H
 
 #include <exception>
+#include <stdexcept>
 #include <type_traits>
 #include <functional>
 #include <vector>
 #include <stack>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <optional>
+#include <string>
+#include <string_view>
+#if __cplusplus > 201703L
+#include <compare>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DICTIONARY_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DICTIONARY_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define DICTIONARY_PREFETCH(address) ((void) 0)
+#endif
 
 //dictionary interface
 template<class TKey, class TValue>
@@ -18,6 +46,21 @@ public:
     virtual void Set(const TKey &key, const TValue &value) = 0;
 
     virtual bool IsSet(const TKey &key) const = 0;
+
+    //returns pointer to the value or nullptr if no, never throws
+    virtual const TValue *TryGet(const TKey &key) const = 0;
+
+    //Get with miss handling chosen at compile time: ThrowOnMiss, DefaultOnMiss or UncheckedOnMiss
+    template<class MissPolicy>
+    const TValue &Get(const TKey &key) const {
+        return MissPolicy::resolve(TryGet(key), key);
+    }
+
+    //returns true if the key was present
+    virtual bool Erase(const TKey &key) = 0;
+
+    //removes every entry the predicate holds for, returns number of removed entries
+    virtual std::size_t EraseIf(const std::function<bool(const TKey &, const TValue &)> &predicate) = 0;
 };
 
 //error interface
@@ -40,6 +83,43 @@ public:
     }
 };
 
+//miss policies for Dictionary::Get<MissPolicy>
+struct ThrowOnMiss {
+    template<class TKey, class TValue>
+    static const TValue &resolve(const TValue *value, const TKey &key) {
+        if (value == nullptr)
+            throw DictionaryNotFoundException<TKey>(key);
+        return *value;
+    }
+};
+
+//a miss returns a default constructed TValue shared by all dictionaries
+struct DefaultOnMiss {
+    template<class TKey, class TValue>
+    static const TValue &resolve(const TValue *value, const TKey &) {
+        static const TValue default_value{};
+        return value != nullptr ? *value : default_value;
+    }
+};
+
+//the caller guarantees the key is present, a miss is undefined behaviour
+struct UncheckedOnMiss {
+    template<class TKey, class TValue>
+    static const TValue &resolve(const TValue *value, const TKey &) noexcept {
+        return *value;
+    }
+};
+
+//constructor argument calling the factory only when an entry is really created
+template<class Factory>
+struct DeferredValue {
+    Factory &factory;
+
+    operator decltype(std::declval<Factory &>()())() const {
+        return factory();
+    }
+};
+
 
 //defining cases of different data capabilities to get right scenario of structure working
 template<class T>
@@ -78,297 +158,5370 @@ struct is_comparable<T, std::void_t<comparison<T>>>
         : std::is_same<comparison<T>, bool> {
 };
 
-//template default dictionaries
-//hash function dictionary: uses "==" and std::hash<T>
-template<class TKey, class TValue, class Enable = void>
-class HashDictionary : Dictionary<TKey, TValue> {
+//heterogeneous lookup is enabled by an "is_transparent" member type of hasher, comparator or key equality
+template<class T, typename = std::void_t<>>
+struct is_transparent_functor
+        : std::false_type {
+};
+template<class T>
+struct is_transparent_functor<T, std::void_t<typename T::is_transparent>>
+        : std::true_type {
 };
 
-//binary tree dictionary: uses "==" and "<" operators
-template<class TKey, class TValue, class Enable = void>
-class TreeDictionary : Dictionary<TKey, TValue> {
+//same checks for a user supplied hasher and key equality
+template<class T, class THasher>
+using policy_hashable = decltype(std::declval<const THasher &>()(std::declval<const T &>()));
+
+template<class T, class TKeyEqual>
+using policy_equality = decltype(std::declval<const TKeyEqual &>()(std::declval<const T &>(),
+                                                                    std::declval<const T &>()));
+
+template<class T, class THasher, typename = std::void_t<>>
+struct is_hashable_by
+        : std::false_type {
+};
+template<class T, class THasher>
+struct is_hashable_by<T, THasher, std::void_t<policy_hashable<T, THasher>>>
+        : std::true_type {
 };
 
-//general ineffective dictionary: uses "==" operator
-template<class TKey, class TValue, class Enable = void>
-class ListDictionary : Dictionary<TKey, TValue> {
+template<class T, class TKeyEqual, typename = std::void_t<>>
+struct is_equal_by
+        : std::false_type {
+};
+template<class T, class TKeyEqual>
+struct is_equal_by<T, TKeyEqual, std::void_t<policy_equality<T, TKeyEqual>>>
+        : std::is_convertible<policy_equality<T, TKeyEqual>, bool> {
+};
+//std::equal_to<T>::operator() is declared for every T, so look at "==" itself
+template<class T>
+struct is_equal_by<T, std::equal_to<T>>
+        : is_equal<T> {
 };
 
+//three-way comparator: Compare(a, b) returns a signed integer (or a C++20 ordering) instead of bool
+template<class T, class TCompare>
+using policy_order = decltype(std::declval<const TCompare &>()(std::declval<const T &>(), std::declval<const T &>()));
 
-template<class TKey, class TValue>
-class HashDictionary<TKey, TValue,
-        typename std::enable_if<is_std_hashable<TKey>::value && is_equal<TKey>::value>::type
->
-        : Dictionary<TKey, TValue> {
-private:
-    const std::size_t MAS_SIZE = 9973;
-    const std::size_t SIZE_MULTIPLIER = 3;
-    const std::size_t PART_EMPTY = 4;
-    int amount = 0;
+template<class T, class TCompare, typename = std::void_t<>>
+struct is_three_way_by
+        : std::false_type {
+};
+template<class T, class TCompare>
+struct is_three_way_by<T, TCompare, std::void_t<policy_order<T, TCompare>>>
+#ifdef __cpp_lib_three_way_comparison
+        : std::bool_constant<(std::is_integral<policy_order<T, TCompare>>::value &&
+                              std::is_signed<policy_order<T, TCompare>>::value) ||
+                             std::is_same<policy_order<T, TCompare>, std::strong_ordering>::value ||
+                             std::is_same<policy_order<T, TCompare>, std::weak_ordering>::value> {
+#else
+        : std::bool_constant<std::is_integral<policy_order<T, TCompare>>::value &&
+                             std::is_signed<policy_order<T, TCompare>>::value> {
+#endif
+};
+
+//keys a concurrent dictionary keeps in std::atomic: trivially copyable and of a lock free size
+template<class T>
+struct is_atomic_key
+        : std::bool_constant<std::is_trivially_copyable<T>::value && sizeof(T) <= sizeof(std::uint64_t) &&
+                             (sizeof(T) & (sizeof(T) - 1)) == 0> {
+};
 
-    std::vector<std::vector<std::pair<TKey, TValue>>> table;
+//keys equal exactly when their bytes are equal, so lookups may compare raw memory: integers except bool (as
+//std::vector<bool> has no data()), enums and pointers under std::equal_to;
+//specialize for own trivially copyable keys whose "==" compares all bytes
+template<class T, class TKeyEqual>
+struct is_bytewise_equal
+        : std::bool_constant<(std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value) &&
+                             !std::is_same<T, bool>::value &&
+                             std::has_unique_object_representations<T>::value &&
+                             (std::is_same<TKeyEqual, std::equal_to<T>>::value ||
+                              std::is_same<TKeyEqual, std::equal_to<>>::value)> {
+};
 
-    inline std::size_t get_place(const TKey &key) const {
-        return (std::hash<TKey>{}(key)) % table.size();
-    }
+//hashing helpers: high and folded halves of the full 64x64->128 bit product
+inline std::uint64_t hash_mul_high(std::uint64_t a, std::uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    return static_cast<std::uint64_t>((static_cast<unsigned __int128>(a) * b) >> 64);
+#else
+    std::uint64_t a_lo = a & 0xFFFFFFFFull, a_hi = a >> 32, b_lo = b & 0xFFFFFFFFull, b_hi = b >> 32;
+    std::uint64_t mid = a_hi * b_lo + ((a_lo * b_lo) >> 32);
+    return a_hi * b_hi + (mid >> 32) + ((a_lo * b_hi + (mid & 0xFFFFFFFFull)) >> 32);
+#endif
+}
 
-    void resize_table() {
-        std::size_t new_size = table.size() * SIZE_MULTIPLIER;
-        std::vector<std::vector<std::pair<TKey, TValue>>> tmp_table(new_size);
-        std::swap(table, tmp_table);
+inline int hash_log2(std::uint64_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(n);
+#else
+    int log = 0;
+    while (n >>= 1)
+        log++;
+    return log;
+#endif
+}
 
-        amount = 0;
-        for (const std::vector<std::pair<TKey, TValue>> &vec : tmp_table)
-            for (const std::pair<TKey, TValue> &pair : vec)
-                this->Set(pair.first, pair.second);
-    }
+inline std::uint64_t hash_mix(std::uint64_t a, std::uint64_t b) {
+    return (a * b) ^ hash_mul_high(a, b);
+}
 
-public:
-    HashDictionary()
-            : table(MAS_SIZE) {
+//wyhash style: 8 byte words are mixed with the running state, the tail is read as one short word
+inline std::uint64_t hash_bytes(const void *data, std::size_t len) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    std::uint64_t h = 0xA0761D6478BD642Full ^ len;
+    std::uint64_t word;
+    for (; len >= 8; bytes += 8, len -= 8) {
+        std::memcpy(&word, bytes, 8);
+        h = hash_mix(word ^ 0xE7037ED1A0B428DBull, h ^ 0x8EBC6AF09C88C6E3ull);
     }
+    word = 0;
+    std::memcpy(&word, bytes, len);
+    return hash_mix(h ^ word ^ 0x589965CC75374CC3ull, 0x1D8E4E27C47D124Full);
+}
 
-    virtual ~HashDictionary() = default;
+//built-in hashers
+//64-bit multiply-fold mixer, every output bit depends on every input bit: good with any index policy
+template<class T, class Enable = void>
+struct MixHash {
+};
+template<class T>
+struct MixHash<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type> {
+    std::size_t operator()(const T &key) const noexcept {
+        return static_cast<std::size_t>(hash_mix(static_cast<std::uint64_t>(key) ^ 0xA0761D6478BD642Full,
+                                                 0xE7037ED1A0B428DBull));
+    }
+};
+//transparent: string views and C strings hash the same as the equal std::string
+template<class CharT, class Traits, class Alloc>
+struct MixHash<std::basic_string<CharT, Traits, Alloc>> {
+    typedef void is_transparent;
 
-    virtual const TValue &Get(const TKey &key) const {
-        std::size_t hash_val = get_place(key);
+    std::size_t operator()(std::basic_string_view<CharT, Traits> key) const noexcept {
+        return static_cast<std::size_t>(hash_bytes(key.data(), key.size() * sizeof(CharT)));
+    }
+};
 
-        for (int i = 0; i < table[hash_val].size(); i++)
-            if (table[hash_val][i].first == key)
-                return table[hash_val][i].second;
+//a single multiplication by 2^64 / phi: only the high bits are well mixed, pair it with FastRangeIndex
+template<class T>
+struct FibonacciHash {
+    std::size_t operator()(const T &key) const noexcept {
+        return static_cast<std::size_t>(static_cast<std::uint64_t>(key) * 0x9E3779B97F4A7C15ull);
+    }
+};
 
-        throw DictionaryNotFoundException<TKey>(key);
+//bucket index policies: round_size picks the table size used for a requested one,
+//index maps a hash into [0, size)
+//any size, one integer division per operation
+struct ModuloIndex {
+    static std::size_t round_size(std::size_t size) {
+        return std::max<std::size_t>(size, 1);
     }
 
-    virtual void Set(const TKey &key, const TValue &value) {
-        amount++;
-        if (amount > table.size() / PART_EMPTY)
-            resize_table();
+    static std::size_t index(std::size_t hash, std::size_t size) {
+        return hash % size;
+    }
+};
 
-        std::size_t hash_val = get_place(key);
+//power of two sizes, takes the low bits as is: needs a hasher like MixHash
+struct MaskIndex {
+    static std::size_t round_size(std::size_t size) {
+        std::size_t rounded = 2;
+        while (rounded < size)
+            rounded *= 2;
+        return rounded;
+    }
 
-        for (std::pair<TKey, TValue> &data : table[hash_val])
-            if (data.first == key) {
-                data.second = value;
-                amount--;
-                return;
-            }
+    static std::size_t index(std::size_t hash, std::size_t size) {
+        return hash & (size - 1);
+    }
+};
 
-        table[hash_val].emplace_back(key, value);
+//any size, maps the hash proportionally by its high bits: needs a hasher like MixHash or FibonacciHash
+struct FastRangeIndex {
+    static std::size_t round_size(std::size_t size) {
+        return std::max<std::size_t>(size, 1);
     }
 
-    virtual bool IsSet(const TKey &key) const {
-        std::size_t hash_val = get_place(key);
+    static std::size_t index(std::size_t hash, std::size_t size) {
+        return static_cast<std::size_t>(hash_mul_high(static_cast<std::uint64_t>(hash) << (64 - 8 * sizeof(hash)),
+                                                      size));
+    }
+};
 
-        for (const std::pair<TKey, TValue> &data : table[hash_val])
-            if (data.first == key)
-                return true;
+//power of two sizes, multiplies by 2^64 / phi and takes the high bits: safe for identity hashes
+struct FibonacciIndex {
+    static std::size_t round_size(std::size_t size) {
+        return MaskIndex::round_size(size);
+    }
 
-        return false;
+    static std::size_t index(std::size_t hash, std::size_t size) {
+        return static_cast<std::size_t>((static_cast<std::uint64_t>(hash) * 0x9E3779B97F4A7C15ull)
+                >> (64 - hash_log2(size)));
     }
 };
 
-template<class TKey, class TValue>
-class TreeDictionary<TKey, TValue,
-        typename std::enable_if<is_comparable<TKey>::value && is_equal<TKey>::value>::type
->
-        : Dictionary<TKey, TValue> {
+//hash dictionaries configuration: hasher, key equality and bucket index policy
+template<class TKey, class THasher = std::hash<TKey>, class TKeyEqual = std::equal_to<TKey>,
+        class TIndex = FibonacciIndex>
+struct HashPolicy {
+    typedef THasher Hasher;
+    typedef TKeyEqual KeyEqual;
+    typedef TIndex Index;
+};
 
-    //AVL-tree node
-    struct DataNode {
-        TKey key;
-        TValue val;
-        unsigned char high;
-        DataNode *left;
-        DataNode *right;
+//for hot maps of integral or string keys, string keys also get heterogeneous lookup
+template<class TKey>
+using FastHashPolicy = HashPolicy<TKey, MixHash<TKey>, std::equal_to<>, MaskIndex>;
+
+//transparent three-way comparator for TreeDictionary: uses compare() member (std::string and string_view),
+//"<=>" under C++20, and two "<" otherwise
+struct ThreeWayCompare {
+    typedef void is_transparent;
+
+private:
+    template<class A, class B>
+    using member_compare = decltype(std::declval<const A &>().compare(std::declval<const B &>()));
 
-        DataNode(const TKey &k, const TValue &v)
-                : key(k), val(v), left(nullptr), right(nullptr), high(1) {}
+    template<class A, class B, typename = std::void_t<>>
+    struct has_compare
+            : std::false_type {
+    };
+    template<class A, class B>
+    struct has_compare<A, B, std::void_t<member_compare<A, B>>>
+            : std::true_type {
     };
 
-    //AVL-tree balance pack
-    inline unsigned char height(DataNode *pointer) {
-        return pointer == nullptr ? 0 : pointer->high;
+public:
+    template<class A, class B>
+    int operator()(const A &a, const B &b) const {
+        if constexpr (has_compare<A, B>::value) {
+            int order = a.compare(b);
+            return order < 0 ? -1 : (order > 0 ? 1 : 0);
+        } else if constexpr (has_compare<B, A>::value) {
+            int order = b.compare(a);
+            return order < 0 ? 1 : (order > 0 ? -1 : 0);
+        }
+#ifdef __cpp_impl_three_way_comparison
+        else if constexpr (std::is_same<decltype(a <=> b), std::strong_ordering>::value ||
+                           std::is_same<decltype(a <=> b), std::weak_ordering>::value) {
+            auto order = a <=> b;
+            return order < 0 ? -1 : (order > 0 ? 1 : 0);
+        }
+#endif
+        else
+            return a < b ? -1 : (b < a ? 1 : 0);
     }
+};
 
-    inline int height_balance(DataNode *node) {
-        return height(node->right) - height(node->left);
-    }
+//node allocation policies of TreeDictionary and ListDictionary
+//every node is a separate new/delete
+struct HeapNodeAllocator {
+    //true if release_all frees all nodes at once, so trivially destructible nodes need no destroy calls
+    static constexpr bool BULK_RELEASE = false;
+    //true if a node created by one allocator may be destroyed by another, so trees can pass nodes over
+    static constexpr bool TRANSFERABLE = true;
 
-    inline void height_restore(DataNode *node) {
-        unsigned char hl = height(node->left), hr = height(node->right);
-        node->high = (hl > hr ? hl : hr) + 1;
+    template<class Node, class... Args>
+    Node *create(Args &&... args) {
+        return new Node(std::forward<Args>(args)...);
     }
 
-    DataNode *rotate_right(DataNode *node) {
-        DataNode *new_top = node->left;
-        node->left = new_top->right;
-        new_top->right = node;
-        height_restore(node);
-        height_restore(new_top);
-        return new_top;
+    template<class Node>
+    void destroy(Node *node) {
+        delete node;
     }
 
-    DataNode *rotate_left(DataNode *node) {
-        DataNode *new_top = node->right;
-        node->right = new_top->left;
-        new_top->left = node;
-        height_restore(node);
-        height_restore(new_top);
-        return new_top;
-    }
+    void release_all() {}
+};
 
-    DataNode *balance(DataNode *node) {
-        height_restore(node);
-        if (height_balance(node) == 2) {
-            if (height_balance(node->right) < 0)
-                node->right = rotate_right(node->right);
-            return rotate_left(node);
-        }
-        if (height_balance(node) == -2) {
-            if (height_balance(node->left) > 0)
-                node->left = rotate_left(node->left);
-            return rotate_right(node);
-        }
-        return node;
-    }
+//nodes are placed one after another in chunks of ChunkNodes slots, destroyed nodes go to a free list
+//for reuse and memory returns to the system chunk by chunk in release_all; serves a single node type
+template<std::size_t ChunkNodes = 256>
+class SlabNodeAllocator {
+    struct FreeSlot {
+        FreeSlot *next;
+    };
 
-    //returns top node of balanced subtree after insertion
-    DataNode *insert(DataNode *pointer, const TKey &key, const TValue &value) {
-        if (pointer == nullptr)
-            return new DataNode(key, value);
-        if (key == pointer->key)
-            pointer->val = value;
-        else if (key < pointer->key)
-            pointer->left = insert(pointer->left, key, value);
-        else
-            pointer->right = insert(pointer->right, key, value);
+    std::vector<std::unique_ptr<unsigned char[]>> chunks;
+    std::size_t chunk_used = ChunkNodes;
+    FreeSlot *free_list = nullptr;
 
-        return balance(pointer);
+    template<class Node>
+    static constexpr std::size_t slot_size() {
+        return (std::max(sizeof(Node), sizeof(FreeSlot)) + alignof(FreeSlot) - 1) / alignof(FreeSlot)
+               * alignof(FreeSlot);
     }
 
-    DataNode *root;
+public:
+    static constexpr bool BULK_RELEASE = true;
+    static constexpr bool TRANSFERABLE = false;
 
-    //returns pointer to data or nullptr if no
-    DataNode *find_value(const TKey &key) const {
-        DataNode *data_pointer = root;
-        while (data_pointer != nullptr) {
-            if (data_pointer->key == key)
-                return data_pointer;
-            if (key < data_pointer->key)
-                data_pointer = data_pointer->left;
-            else
-                data_pointer = data_pointer->right;
+    SlabNodeAllocator() = default;
+
+    SlabNodeAllocator(const SlabNodeAllocator &) = delete;
+
+    SlabNodeAllocator &operator=(const SlabNodeAllocator &) = delete;
+
+    template<class Node, class... Args>
+    Node *create(Args &&... args) {
+        static_assert(alignof(Node) <= alignof(std::max_align_t), "over-aligned nodes are not supported");
+
+        void *memory;
+        if (free_list != nullptr) {
+            memory = free_list;
+            free_list = free_list->next;
+        } else {
+            if (chunk_used == ChunkNodes) {
+                chunks.emplace_back(new unsigned char[ChunkNodes * slot_size<Node>()]);
+                chunk_used = 0;
+            }
+            memory = chunks.back().get() + chunk_used++ * slot_size<Node>();
+        }
+
+        try {
+            return new(memory) Node(std::forward<Args>(args)...);
+        } catch (...) {
+            free_list = new(memory) FreeSlot{free_list};
+            throw;
         }
-        return nullptr;
     }
 
-public:
-    TreeDictionary()
-            : root(nullptr) {
+    template<class Node>
+    void destroy(Node *node) {
+        node->~Node();
+        free_list = new(static_cast<void *>(node)) FreeSlot{free_list};
     }
 
-    ~TreeDictionary() {//delete tree
-        std::stack<DataNode *> st;
-        if (root != nullptr)
-            st.push(root);
+    void release_all() {
+        chunks.clear();
+        chunk_used = ChunkNodes;
+        free_list = nullptr;
+    }
+};
 
-        while (st.size() != 0) {
-            DataNode *pointer = st.top();
-            st.pop();
-            if (pointer->left != nullptr)
-                st.push(pointer->left);
-            if (pointer->right != nullptr)
-                st.push(pointer->right);
-            delete pointer;
-        }
+//reordering policies of ListDictionary: hit moves a node found by a lookup, link points to the link holding it
+//and prev_link to the link holding its predecessor (nullptr at the head); INSERT_AT_END places new keys
+//at the tail instead of the head; REORDERS is false if hit never moves a node
+
+//the list keeps insertion order, new keys go to the head
+struct StaticOrder {
+    static constexpr bool INSERT_AT_END = false;
+    static constexpr bool REORDERS = false;
+
+    struct NodeData {
     };
 
-    virtual const TValue &Get(const TKey &key) const {
-        DataNode *data = find_value(key);
-        if (data != nullptr)
-            return data->val;
+    template<class Node>
+    static void hit(Node *&, Node **, Node **) {}
+};
 
-        throw DictionaryNotFoundException<TKey>(key);
+//a found node moves to the head
+struct MoveToFront {
+    static constexpr bool INSERT_AT_END = false;
+    static constexpr bool REORDERS = true;
+
+    struct NodeData {
+    };
+
+    template<class Node>
+    static void hit(Node *&head, Node **link, Node **) {
+        Node *node = *link;
+        if (node == head)
+            return;
+        *link = node->next;
+        node->next = head;
+        head = node;
     }
+};
 
-    virtual void Set(const TKey &key, const TValue &value) {
-        root = insert(root, key, value);
+//a found node swaps with its predecessor, new keys start at the tail
+struct Transpose {
+    static constexpr bool INSERT_AT_END = true;
+    static constexpr bool REORDERS = true;
+
+    struct NodeData {
+    };
+
+    template<class Node>
+    static void hit(Node *&, Node **link, Node **prev_link) {
+        if (prev_link == nullptr)
+            return;
+        Node *previous = *prev_link, *node = *link;
+        previous->next = node->next;
+        node->next = previous;
+        *prev_link = node;
     }
+};
 
-    virtual bool IsSet(const TKey &key) const {
-        return find_value(key) != nullptr;
+//nodes count their hits and stay sorted by them, a found node moves before the nodes with fewer hits
+struct CountOrder {
+    static constexpr bool INSERT_AT_END = true;
+    static constexpr bool REORDERS = true;
+
+    struct NodeData {
+        std::size_t hits = 0;
+    };
+
+    template<class Node>
+    static void hit(Node *&head, Node **link, Node **) {
+        Node *node = *link;
+        node->hits++;
+        Node **place = &head;
+        while (*place != node && (*place)->hits >= node->hits)
+            place = &(*place)->next;
+        if (*place == node)
+            return;
+        *link = node->next;
+        node->next = *place;
+        *place = node;
     }
 };
 
-template<class TKey, class TValue>
-class ListDictionary<TKey, TValue,
-        typename std::enable_if<is_equal<TKey>::value>::type
->
-        : public Dictionary<TKey, TValue> {
+//template default dictionaries
+//hash function dictionary: uses Policy hasher and key equality, "==" and std::hash<T> by default
+template<class TKey, class TValue, class Policy = HashPolicy<TKey>, class Enable = void>
+class HashDictionary : Dictionary<TKey, TValue> {
+};
+
+//open addressing hash dictionary: same requirements as HashDictionary, probes 16 control bytes at once
+template<class TKey, class TValue, class Policy = HashPolicy<TKey>, class Enable = void>
+class FlatHashDictionary : Dictionary<TKey, TValue> {
+};
+
+//binary tree dictionary: uses "==" and "<" operators, ordering goes through Compare;
+//a three-way Compare (ThreeWayCompare) replaces both and needs one call per tree level;
+//OrderStatistics keeps subtree sizes in nodes for Select, Rank and CountInRange
+template<class TKey, class TValue, class Compare = std::less<TKey>, class NodeAllocator = HeapNodeAllocator,
+        bool OrderStatistics = false, class Enable = void>
+class TreeDictionary : Dictionary<TKey, TValue> {
+};
+
+//persistent binary tree dictionary: same requirements as TreeDictionary, Set and Erase copy the search path
+//and share the rest, so Snapshot is O(1)
+template<class TKey, class TValue, class Compare = std::less<TKey>, class Enable = void>
+class PersistentTreeDictionary : Dictionary<TKey, TValue> {
+};
+
+//compact binary tree dictionary: same requirements as TreeDictionary, nodes lie in one vector
+//and link by 32-bit indices, up to 2^30 - 1 entries
+template<class TKey, class TValue, class Compare = std::less<TKey>, class Enable = void>
+class CompactTreeDictionary : Dictionary<TKey, TValue> {
+};
+
+//read-only snapshot of an ordered dictionary, made by TreeDictionary::Freeze or from sorted pairs
+template<class TKey, class TValue, class Compare = std::less<TKey>>
+class FrozenDictionary;
+
+//B+-tree dictionary: same requirements as TreeDictionary, keys lie contiguously in cache line sized nodes
+template<class TKey, class TValue, class Compare = std::less<TKey>, class Enable = void>
+class BTreeDictionary : Dictionary<TKey, TValue> {
+};
+
+//thread-safe B+-tree dictionary: uses "==" and "<" operators, keys must be trivially copyable
+//and of 1, 2, 4 or 8 bytes; readers are optimistic and validate node versions, writers lock only nodes they change;
+//unlike the other engines it is not a Dictionary: Get returns a copy and TryGet(key, value) copies into value
+//and returns bool, as a reference may outlive the entry once another thread replaces it
+template<class TKey, class TValue, class Compare = std::less<TKey>, class Enable = void>
+class ConcurrentBTreeDictionary {
+    static_assert(is_comparable<TKey>::value && is_equal<TKey>::value,
+                  "ConcurrentBTreeDictionary: the key needs \"<\" and \"==\"");
+    static_assert(is_atomic_key<TKey>::value,
+                  "ConcurrentBTreeDictionary: the key must be trivially copyable and of 1, 2, 4 or 8 bytes");
+};
 
+//general ineffective dictionary: uses "==" operator, through KeyEqual;
+//Reorder (MoveToFront, Transpose, CountOrder) moves keys found by Find and by Set of an existing key closer
+//to the head; const lookups (Get, TryGet, IsSet) never reorder, so they are safe to run concurrently
+template<class TKey, class TValue, class KeyEqual = std::equal_to<TKey>, class NodeAllocator = HeapNodeAllocator,
+        class Reorder = StaticOrder, class Enable = void>
+class ListDictionary : Dictionary<TKey, TValue> {
+};
+
+//list dictionary without a node per key: same requirements as ListDictionary; bytewise equal keys lie in one
+//array scanned 16 bytes at once, other keys in blocks of BLOCK_SIZE; Set and Erase may move values
+template<class TKey, class TValue, class KeyEqual = std::equal_to<TKey>, class Enable = void>
+class UnrolledListDictionary : Dictionary<TKey, TValue> {
+};
+
+
+template<class TKey, class TValue, class Policy>
+class HashDictionary<TKey, TValue, Policy,
+        typename std::enable_if<is_hashable_by<TKey, typename Policy::Hasher>::value &&
+                                is_equal_by<TKey, typename Policy::KeyEqual>::value>::type
+>
+        : Dictionary<TKey, TValue> {
 private:
-    //Linkedlist node
-    struct DataNode {
+    //bucket entry, keeps the full hash so rehashing and mismatching lookups never rehash the key
+    struct Entry {
+        std::size_t hash;
         TKey key;
         TValue val;
-        DataNode *next;
 
-        DataNode(const TKey &k, const TValue &v)
-                : key(k), val(v), next(nullptr) {}
+        template<class K, class... Args>
+        Entry(std::size_t h, K &&k, Args &&... args)
+                : hash(h), key(std::forward<K>(k)), val(std::forward<Args>(args)...) {}
     };
 
-    DataNode *root = nullptr;
+    //chained bucket, value-initialization makes it empty
+    struct Bucket {
+        Entry *entries;
+        std::size_t size;
+        std::size_t capacity;
 
-    DataNode *find_value(const TKey &key) const {
-        DataNode *pointer = root;
-        while (pointer != nullptr)
-            if (pointer->key == key)
-                return pointer;
-            else
-                pointer = pointer->next;
+        Entry *begin() {
+            return entries;
+        }
 
-        return nullptr;
-    }
+        Entry *end() {
+            return entries + size;
+        }
 
-public:
-    ListDictionary() = default;
+        const Entry *begin() const {
+            return entries;
+        }
 
-    ~ListDictionary() {
-        std::stack<DataNode *> st;
-        if (root != nullptr)
-            st.push(root);
-        while (st.size() != 0) {
-            DataNode *pointer = st.top();
-            st.pop();
-            if (pointer->next != nullptr)
-                st.push(pointer->next);
-            delete pointer;
+        const Entry *end() const {
+            return entries + size;
         }
-    }
 
-    virtual const TValue &Get(const TKey &key) const {
-        DataNode *pointer = find_value(key);
-        if (pointer != nullptr)
-            return pointer->val;
+        Entry &back() {
+            return entries[size - 1];
+        }
 
-        throw DictionaryNotFoundException<TKey>(key);
-    }
+        const Entry *data() const {
+            return entries;
+        }
 
-    virtual void Set(const TKey &key, const TValue &value) {
-        DataNode *pointer = find_value(key);
-        if (pointer != nullptr)
-            pointer->val = value;
-        else {
-            auto *new_node = new DataNode(key, value);
-            new_node->next = root;
-            root = new_node;
+        template<class... Args>
+        void emplace_back(Args &&... args) {
+            if (size == capacity)
+                reallocate(capacity == 0 ? 1 : 2 * capacity);
+            new(entries + size) Entry(std::forward<Args>(args)...);
+            size++;
         }
+
+        void pop_back() {
+            entries[--size].~Entry();
+        }
+
+        //destroys the entries from pos to the end
+        void truncate(Entry *pos) {
+            std::destroy(pos, end());
+            size = static_cast<std::size_t>(pos - entries);
+        }
+
+        void clear() {
+            truncate(entries);
+            std::allocator<Entry>().deallocate(entries, capacity);
+            entries = nullptr;
+            capacity = 0;
+        }
+
+        void reallocate(std::size_t new_capacity) {
+            Entry *moved = std::allocator<Entry>().allocate(new_capacity);
+            try {
+                std::uninitialized_move(begin(), end(), moved);
+            } catch (...) {
+                std::allocator<Entry>().deallocate(moved, new_capacity);
+                throw;
+            }
+            std::destroy(begin(), end());
+            std::allocator<Entry>().deallocate(entries, capacity);
+            entries = moved;
+            capacity = new_capacity;
+        }
+    };
+
+    //buckets in chunks of CHUNK: a new table only allocates the chunk pointers, a chunk is created when
+    //its first entry arrives, and a migrated chunk of the old table is freed at once; so neither growth
+    //nor draining does work proportional to the table size in a single call
+    class Table {
+        static constexpr std::size_t CHUNK = 1024;
+        static inline const Bucket EMPTY{};
+
+        Bucket **chunks = nullptr;
+        std::size_t count = 0;
+
+        std::size_t chunk_count() const {
+            return (count + CHUNK - 1) / CHUNK;
+        }
+
+        std::size_t chunk_size(std::size_t chunk) const {
+            return std::min(CHUNK, count - chunk * CHUNK);
+        }
+
+    public:
+        Table() = default;
+
+        explicit Table(std::size_t size)
+                : count(size) {
+            chunks = new Bucket *[chunk_count()]();
+        }
+
+        Table(const Table &other)
+                : Table(other.count) {
+            for (std::size_t i = 0; i < count; i++)
+                for (const Entry &data : other[i])
+                    touch(i).emplace_back(data);
+        }
+
+        Table(Table &&other) noexcept {
+            swap(other);
+        }
+
+        Table &operator=(Table other) noexcept {
+            swap(other);
+            return *this;
+        }
+
+        ~Table() {
+            for (std::size_t chunk = 0; chunk < chunk_count(); chunk++)
+                release_chunk(chunk);
+            delete[] chunks;
+        }
+
+        void swap(Table &other) noexcept {
+            std::swap(chunks, other.chunks);
+            std::swap(count, other.count);
+        }
+
+        std::size_t size() const {
+            return count;
+        }
+
+        bool empty() const {
+            return count == 0;
+        }
+
+        //bucket i, an empty one if its chunk was never created
+        const Bucket &operator[](std::size_t i) const {
+            const Bucket *chunk = chunks[i / CHUNK];
+            return chunk != nullptr ? chunk[i % CHUNK] : EMPTY;
+        }
+
+        //bucket i or nullptr if its chunk was never created
+        Bucket *find(std::size_t i) {
+            Bucket *chunk = chunks[i / CHUNK];
+            return chunk != nullptr ? chunk + i % CHUNK : nullptr;
+        }
+
+        //bucket i, creating its chunk on first use
+        Bucket &touch(std::size_t i) {
+            Bucket *&chunk = chunks[i / CHUNK];
+            if (chunk == nullptr)
+                chunk = new Bucket[chunk_size(i / CHUNK)]();
+            return chunk[i % CHUNK];
+        }
+
+        //clears and frees the chunk holding bucket i once i is its last bucket
+        void release_passed(std::size_t i) {
+            if ((i + 1) % CHUNK == 0 || i + 1 == count)
+                release_chunk(i / CHUNK);
+        }
+
+        void release_chunk(std::size_t chunk) {
+            if (chunks[chunk] == nullptr)
+                return;
+            for (std::size_t i = 0; i < chunk_size(chunk); i++)
+                chunks[chunk][i].clear();
+            delete[] chunks[chunk];
+            chunks[chunk] = nullptr;
+        }
+    };
+
+    typedef typename Policy::Index Index;
+
+    const std::size_t MAS_SIZE = 16;
+    const std::size_t SIZE_MULTIPLIER = 3;
+    const std::size_t PART_EMPTY = 4;
+    static constexpr std::size_t BATCH_SIZE = 16;
+    static constexpr double MIN_LOAD_FACTOR = 1.0 / 64;
+    static constexpr double MAX_LOAD_FACTOR = 64;
+    std::size_t amount = 0;
+
+    //table is allocated by the first Set with min_size buckets and never shrinks below it;
+    //the default is small, pre-size with Reserve or the expected_count constructor
+    Table table;
+    std::size_t min_size = Index::round_size(MAS_SIZE);
+
+    //size requested before Index rounding: growth and shrinking scale it, so a rounding policy
+    //does not compound into a larger growth factor
+    std::size_t nominal_size = 0;
+
+    double max_load = 1.0 / PART_EMPTY;
+    std::size_t growth = SIZE_MULTIPLIER;
+    std::size_t grow_limit = 0;
+    std::size_t shrink_limit = 0;
+
+    //incremental resize: buckets of old_table below migrate_pos are already moved to table
+    Table old_table;
+    std::size_t migrate_pos = 0;
+    std::size_t migrate_step = 0;
+    std::size_t resize_step = 0;
+
+    typename Policy::Hasher hasher;
+    typename Policy::KeyEqual key_equal;
+
+    inline std::size_t get_hash(const TKey &key) const {
+        return hasher(key);
+    }
+
+    static inline std::size_t get_place(std::size_t hash, const Table &tab) {
+        return Index::index(hash, tab.size());
+    }
+
+    inline bool migrating() const {
+        return !old_table.empty();
+    }
+
+    //load factor kept in [MIN_LOAD_FACTOR, MAX_LOAD_FACTOR], zero, negative and NaN give the minimum
+    static inline double clamp_load(double load_factor) {
+        if (load_factor > MAX_LOAD_FACTOR)
+            return MAX_LOAD_FACTOR;
+        return load_factor >= MIN_LOAD_FACTOR ? load_factor : MIN_LOAD_FACTOR;
+    }
+
+    //number of buckets keeping count entries under the load limit
+    inline std::size_t buckets_for(std::size_t count) const {
+        return static_cast<std::size_t>(count / max_load) + 1;
+    }
+
+    //enables overloads taking any key type K the hasher and key equality are transparent for
+    template<class K>
+    using if_transparent = typename std::enable_if<!std::is_same<K, TKey>::value &&
+                                                   is_transparent_functor<typename Policy::Hasher>::value &&
+                                                   is_transparent_functor<typename Policy::KeyEqual>::value>::type;
+
+    //returns pointer to data or nullptr if no
+    template<class K>
+    const Entry *find_value(const K &key, std::size_t hash) const {
+        if (table.empty())
+            return nullptr;
+
+        for (const Entry &data : table[get_place(hash, table)])
+            if (data.hash == hash && key_equal(data.key, key))
+                return &data;
+
+        if (migrating()) {
+            std::size_t old_val = get_place(hash, old_table);
+            if (old_val >= migrate_pos)
+                for (const Entry &data : old_table[old_val])
+                    if (data.hash == hash && key_equal(data.key, key))
+                        return &data;
+        }
+        return nullptr;
+    }
+
+    //removes the entry by moving the last one of the bucket in its place
+    bool erase_from(Bucket *bucket, const TKey &key, std::size_t hash) {
+        if (bucket == nullptr)
+            return false;
+        for (Entry &data : *bucket)
+            if (data.hash == hash && key_equal(data.key, key)) {
+                if (&data != &bucket->back())
+                    data = std::move(bucket->back());
+                bucket->pop_back();
+                return true;
+            }
+        return false;
+    }
+
+    //erases matching entries of the buckets from the from-th one to the end of tab
+    static std::size_t erase_if_from(Table &tab, std::size_t from,
+                                     const std::function<bool(const TKey &, const TValue &)> &predicate) {
+        std::size_t removed = 0;
+        for (std::size_t i = from; i < tab.size(); i++) {
+            Bucket *bucket = tab.find(i);
+            if (bucket == nullptr)
+                continue;
+            Entry *end = std::remove_if(bucket->begin(), bucket->end(), [&predicate](const Entry &data) {
+                return predicate(data.key, data.val);
+            });
+            removed += bucket->end() - end;
+            bucket->truncate(end);
+        }
+        return removed;
+    }
+
+    //moves up to count buckets of old_table into table by their cached hashes; a moved bucket is cleared
+    //at once, so buckets below migrate_pos stay empty until their chunk is freed and a copy skips them
+    void migrate(std::size_t count) {
+        for (; count != 0 && migrate_pos < old_table.size(); count--, migrate_pos++) {
+            if (Bucket *bucket = old_table.find(migrate_pos)) {
+                for (Entry &data : *bucket)
+                    table.touch(get_place(data.hash, table)).emplace_back(std::move(data));
+                bucket->clear();
+            }
+            old_table.release_passed(migrate_pos);
+        }
+
+        if (migrate_pos == old_table.size()) {
+            Table().swap(old_table);
+            migrate_pos = 0;
+        }
+    }
+
+    //returns pointer to the value of the key and true if it was created from args, args are untouched otherwise
+    template<class K, class... Args>
+    std::pair<TValue *, bool> emplace_hashed(K &&key, std::size_t hash, Args &&... args) {
+        if (migrating())
+            migrate(resize_step);
+
+        Entry *data = const_cast<Entry *>(find_value(key, hash));
+        if (data != nullptr)
+            return std::pair<TValue *, bool>(&data->val, false);
+
+        //the table grows for the entry first, amount counts it only once it is built, so a throwing
+        //constructor leaves the size as it was
+        std::size_t count = amount + 1;
+        if (table.empty())
+            resize_table(min_size, count);
+        else if (count > grow_limit)
+            resize_table(std::max(nominal_size * growth, buckets_for(count)), count);
+
+        Bucket &bucket = table.touch(get_place(hash, table));
+        bucket.emplace_back(hash, std::forward<K>(key), std::forward<Args>(args)...);
+        amount++;
+        return std::pair<TValue *, bool>(&bucket.back().val, true);
+    }
+
+    template<class K, class... Args>
+    std::pair<TValue *, bool> emplace_key(K &&key, Args &&... args) {
+        std::size_t hash = get_hash(key);
+        return emplace_hashed(std::forward<K>(key), hash, std::forward<Args>(args)...);
+    }
+
+    template<class K, class V>
+    void set_hashed(K &&key, std::size_t hash, V &&value) {
+        std::pair<TValue *, bool> place = emplace_hashed(std::forward<K>(key), hash, std::forward<V>(value));
+        if (!place.second)
+            *place.first = std::forward<V>(value);
+    }
+
+    template<class K, class V>
+    void assign(K &&key, V &&value) {
+        std::size_t hash = get_hash(key);
+        set_hashed(std::forward<K>(key), hash, std::forward<V>(value));
+    }
+
+    //hashes a batch of keys and prefetches their buckets: bucket headers first, then entries;
+    //during an incremental resize the old buckets not yet migrated are prefetched as well
+    void prefetch_batch(const TKey *keys, std::size_t batch, std::size_t *hashes) const {
+        std::size_t places[BATCH_SIZE];
+        for (std::size_t i = 0; i < batch; i++)
+            hashes[i] = get_hash(keys[i]);
+        if (table.empty())
+            return;
+
+        for (std::size_t i = 0; i < batch; i++) {
+            places[i] = get_place(hashes[i], table);
+            DICTIONARY_PREFETCH(&table[places[i]]);
+        }
+        for (std::size_t i = 0; i < batch; i++)
+            DICTIONARY_PREFETCH(table[places[i]].data());
+        if (!migrating())
+            return;
+
+        for (std::size_t i = 0; i < batch; i++) {
+            std::size_t old_place = get_place(hashes[i], old_table);
+            if (old_place >= migrate_pos)
+                DICTIONARY_PREFETCH(old_table[old_place].data());
+        }
+    }
+
+    //count is the number of entries the new table is sized for
+    void resize_table(std::size_t new_size, std::size_t count) {
+        if (migrating())
+            migrate(old_table.size());
+
+        old_table.swap(table);
+        nominal_size = new_size;
+        new_size = Index::round_size(new_size);
+        Table(new_size).swap(table);
+        migrate_pos = 0;
+        grow_limit = static_cast<std::size_t>(new_size * max_load);
+        shrink_limit = grow_limit / (2 * growth);
+
+        if (migrate_step == 0 || old_table.empty()) {
+            migrate(old_table.size());
+            return;
+        }
+        //the old table must be drained before the new one reaches either of its load limits
+        std::size_t ops_left = std::min(grow_limit - std::min(grow_limit, count),
+                                        count - std::min(shrink_limit, count));
+        resize_step = std::max(migrate_step, old_table.size() / std::max<std::size_t>(ops_left, 1) + 1);
+    }
+
+    //gives memory back once the load falls well below the limit, keeping hysteresis with growth
+    void shrink_table() {
+        if (amount >= shrink_limit)
+            return;
+
+        std::size_t new_size = nominal_size;
+        while (new_size > min_size &&
+               amount < static_cast<std::size_t>(Index::round_size(new_size) * max_load) / (2 * growth))
+            new_size = std::max(new_size / growth, min_size);
+        if (Index::round_size(new_size) < table.size())
+            resize_table(new_size, amount);
+    }
+
+public:
+    HashDictionary() = default;
+
+    //sizes the table for expected_count entries, nothing is allocated before the first Set
+    explicit HashDictionary(std::size_t expected_count, double max_load_factor = 0.25,
+                            std::size_t growth_factor = 3)
+            : max_load(clamp_load(max_load_factor)), growth(std::max<std::size_t>(growth_factor, 2)) {
+        min_size = Index::round_size(buckets_for(expected_count));
+    }
+
+    virtual ~HashDictionary() = default;
+
+    //makes room for count entries without any further resize
+    void Reserve(std::size_t count) {
+        std::size_t new_size = Index::round_size(buckets_for(count));
+        min_size = std::max(min_size, new_size);
+        if (!table.empty() && new_size > table.size()) {
+            std::size_t step = migrate_step;
+            migrate_step = 0;
+            resize_table(new_size, amount);
+            migrate_step = step;
+        }
+    }
+
+    //load limit (entries per bucket) that triggers growth, applied from the next Set;
+    //clamped to [1/64, 64] like the growth factor is to at least 2
+    void SetMaxLoadFactor(double max_load_factor) {
+        max_load = clamp_load(max_load_factor);
+        grow_limit = static_cast<std::size_t>(table.size() * max_load);
+        shrink_limit = grow_limit / (2 * growth);
+    }
+
+    //the table grows growth_factor times when the load limit is crossed
+    void SetGrowthFactor(std::size_t growth_factor) {
+        growth = std::max<std::size_t>(growth_factor, 2);
+        shrink_limit = grow_limit / (2 * growth);
+    }
+
+    std::size_t Size() const {
+        return amount;
+    }
+
+    std::size_t BucketCount() const {
+        return table.size();
+    }
+
+    //buckets_per_step > 0 spreads every resize over the following Set and Erase calls, moving that many
+    //old buckets (or more, if needed to finish before the next resize) per call; 0 - resize at once;
+    //bucket chunks are created on first use and freed once migrated, so the Set that triggers a resize
+    //only allocates the chunk pointers; Get is const and never migrates, it searches both tables instead
+    void SetIncrementalResize(std::size_t buckets_per_step) {
+        migrate_step = buckets_per_step;
+        if (migrate_step == 0 && migrating())
+            migrate(old_table.size());
+    }
+
+    //old buckets still waiting to be moved by an incremental resize, lookups search them too
+    std::size_t PendingBuckets() const {
+        return migrating() ? old_table.size() - migrate_pos : 0;
+    }
+
+    using Dictionary<TKey, TValue>::Get;
+
+    virtual const TValue &Get(const TKey &key) const {
+        const Entry *data = find_value(key, get_hash(key));
+        if (data != nullptr)
+            return data->val;
+
+        throw DictionaryNotFoundException<TKey>(key);
+    }
+
+    virtual const TValue *TryGet(const TKey &key) const {
+        const Entry *data = find_value(key, get_hash(key));
+        return data != nullptr ? &data->val : nullptr;
+    }
+
+    virtual void Set(const TKey &key, const TValue &value) {
+        assign(key, value);
+    }
+
+    void Set(const TKey &key, TValue &&value) {
+        assign(key, std::move(value));
+    }
+
+    void Set(TKey &&key, const TValue &value) {
+        assign(std::move(key), value);
+    }
+
+    void Set(TKey &&key, TValue &&value) {
+        assign(std::move(key), std::move(value));
+    }
+
+    //constructs the value from args only if the key is missing, returns true if it was inserted
+    template<class... Args>
+    bool TryEmplace(const TKey &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...).second;
+    }
+
+    template<class... Args>
+    bool TryEmplace(TKey &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...).second;
+    }
+
+    //returns the value of the key, a missing key is inserted with factory() first
+    template<class Factory>
+    TValue &GetOrInsert(const TKey &key, Factory &&factory) {
+        return *emplace_key(key, DeferredValue<Factory>{factory}).first;
+    }
+
+    //applies fn to the value of the key in place, a missing key is inserted with TValue() first
+    template<class Fn>
+    void Upsert(const TKey &key, Fn &&fn) {
+        fn(*emplace_key(key).first);
+    }
+
+    virtual bool IsSet(const TKey &key) const {
+        return find_value(key, get_hash(key)) != nullptr;
+    }
+
+    //heterogeneous lookup: K is compared with stored keys directly, TKey is built only for the exception
+    template<class K, class = if_transparent<K>>
+    const TValue &Get(const K &key) const {
+        const TValue *value = TryGet(key);
+        if (value != nullptr)
+            return *value;
+
+        throw DictionaryNotFoundException<TKey>(TKey(key));
+    }
+
+    template<class K, class = if_transparent<K>>
+    const TValue *TryGet(const K &key) const {
+        const Entry *data = find_value(key, hasher(key));
+        return data != nullptr ? &data->val : nullptr;
+    }
+
+    template<class K, class = if_transparent<K>>
+    bool IsSet(const K &key) const {
+        return find_value(key, hasher(key)) != nullptr;
+    }
+
+    //looks up count keys, prefetching the buckets of each batch before resolving it;
+    //values[i] receives the value and bit i of found is set for every present key,
+    //found must hold (count + 63) / 64 words; returns the number of present keys
+    std::size_t GetMany(const TKey *keys, std::size_t count, TValue *values, std::uint64_t *found) const {
+        std::fill(found, found + (count + 63) / 64, 0);
+        std::size_t hits = 0;
+        std::size_t hashes[BATCH_SIZE];
+        for (std::size_t from = 0; from < count; from += BATCH_SIZE) {
+            std::size_t batch = std::min(BATCH_SIZE, count - from);
+            prefetch_batch(keys + from, batch, hashes);
+            for (std::size_t i = 0; i < batch; i++) {
+                const Entry *data = find_value(keys[from + i], hashes[i]);
+                if (data != nullptr) {
+                    values[from + i] = data->val;
+                    found[(from + i) / 64] |= std::uint64_t(1) << ((from + i) % 64);
+                    hits++;
+                }
+            }
+        }
+        return hits;
+    }
+
+    void SetMany(const TKey *keys, const TValue *values, std::size_t count) {
+        std::size_t hashes[BATCH_SIZE];
+        for (std::size_t from = 0; from < count; from += BATCH_SIZE) {
+            std::size_t batch = std::min(BATCH_SIZE, count - from);
+            prefetch_batch(keys + from, batch, hashes);
+            for (std::size_t i = 0; i < batch; i++)
+                set_hashed(keys[from + i], hashes[i], values[from + i]);
+        }
+    }
+
+    virtual bool Erase(const TKey &key) {
+        if (table.empty())
+            return false;
+        if (migrating())
+            migrate(resize_step);
+
+        std::size_t hash = get_hash(key);
+        bool erased = erase_from(table.find(get_place(hash, table)), key, hash);
+        if (!erased && migrating()) {
+            std::size_t old_val = get_place(hash, old_table);
+            erased = old_val >= migrate_pos && erase_from(old_table.find(old_val), key, hash);
+        }
+        if (!erased)
+            return false;
+
+        amount--;
+        shrink_table();
+        return true;
+    }
+
+    virtual std::size_t EraseIf(const std::function<bool(const TKey &, const TValue &)> &predicate) {
+        //old buckets below migrate_pos are already in table
+        std::size_t removed = erase_if_from(table, 0, predicate) +
+                              erase_if_from(old_table, migrate_pos, predicate);
+        amount -= removed;
+        shrink_table();
+        return removed;
+    }
+};
+
+template<class TKey, class TValue, class Policy>
+class FlatHashDictionary<TKey, TValue, Policy,
+        typename std::enable_if<is_hashable_by<TKey, typename Policy::Hasher>::value &&
+                                is_equal_by<TKey, typename Policy::KeyEqual>::value>::type
+>
+        : Dictionary<TKey, TValue> {
+private:
+    //control byte of a slot: EMPTY, DELETED (tombstone) or the low 7 bits of the hash ("h2") for a full slot
+    typedef signed char ctrl_t;
+    typedef std::pair<TKey, TValue> Slot;
+
+    static constexpr ctrl_t CTRL_EMPTY = -128;
+    static constexpr ctrl_t CTRL_DELETED = -2;
+    static constexpr std::size_t GROUP_WIDTH = 16;
+    static constexpr std::size_t NPOS = static_cast<std::size_t>(-1);
+    static constexpr std::size_t BATCH_SIZE = 16;
+
+    //16 consecutive control bytes matched in parallel, bit i of a mask refers to slot i of the group
+    struct Group {
+#ifdef DICTIONARY_HAS_SSE2
+        __m128i ctrl;
+
+        explicit Group(const ctrl_t *pos)
+                : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pos))) {}
+
+        inline std::uint32_t match(ctrl_t h2) const {
+            return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2))));
+        }
+
+        //every non-full control byte has its sign bit set
+        inline std::uint32_t match_free() const {
+            return static_cast<std::uint32_t>(_mm_movemask_epi8(ctrl));
+        }
+#else
+        const ctrl_t *ctrl;
+
+        explicit Group(const ctrl_t *pos)
+                : ctrl(pos) {}
+
+        inline std::uint32_t match(ctrl_t h2) const {
+            std::uint32_t mask = 0;
+            for (std::size_t i = 0; i < GROUP_WIDTH; i++)
+                if (ctrl[i] == h2)
+                    mask |= 1u << i;
+            return mask;
+        }
+
+        inline std::uint32_t match_free() const {
+            std::uint32_t mask = 0;
+            for (std::size_t i = 0; i < GROUP_WIDTH; i++)
+                if (ctrl[i] < 0)
+                    mask |= 1u << i;
+            return mask;
+        }
+#endif
+
+        inline std::uint32_t match_empty() const {
+            return match(CTRL_EMPTY);
+        }
+    };
+
+    std::size_t capacity = 0;
+    std::size_t amount = 0;
+    std::size_t growth_left = 0;
+    std::size_t min_capacity = 0;
+
+    std::unique_ptr<ctrl_t[]> ctrl;
+    Slot *slots = nullptr;
+
+    static inline std::size_t lowest_bit(std::uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<std::size_t>(__builtin_ctz(mask));
+#else
+        std::size_t pos = 0;
+        while ((mask & 1u) == 0) {
+            mask >>= 1;
+            pos++;
+        }
+        return pos;
+#endif
+    }
+
+    typename Policy::Hasher hasher;
+    typename Policy::KeyEqual key_equal;
+
+    template<class K>
+    using if_transparent = typename std::enable_if<!std::is_same<K, TKey>::value &&
+                                                   is_transparent_functor<typename Policy::Hasher>::value &&
+                                                   is_transparent_functor<typename Policy::KeyEqual>::value>::type;
+
+    //std::hash is the identity for integers, so spread it before splitting into group index and h2;
+    //the group index is always a mask, Policy::Index is not used here
+    template<class K>
+    inline std::size_t hash_of(const K &key) const {
+        std::uint64_t h = static_cast<std::uint64_t>(hasher(key)) * 0x9E3779B97F4A7C15ull;
+        return static_cast<std::size_t>(h ^ (h >> 32));
+    }
+
+    static inline ctrl_t h2_of(std::size_t hash) {
+        return static_cast<ctrl_t>(hash & 0x7F);
+    }
+
+    //number of slots keeping count entries under the 7/8 load limit
+    static std::size_t capacity_for(std::size_t count) {
+        std::size_t new_capacity = GROUP_WIDTH;
+        while (new_capacity - new_capacity / 8 < count)
+            new_capacity *= 2;
+        return new_capacity;
+    }
+
+    //first group of the probe sequence, later groups are visited with triangular steps
+    inline std::size_t first_group(std::size_t hash) const {
+        return (hash >> 7) & (capacity / GROUP_WIDTH - 1);
+    }
+
+    //returns slot index of the key or NPOS if no
+    template<class K>
+    std::size_t find_index(const K &key, std::size_t hash) const {
+        if (capacity == 0)
+            return NPOS;
+
+        const std::size_t group_mask = capacity / GROUP_WIDTH - 1;
+        const ctrl_t h2 = h2_of(hash);
+        std::size_t group = first_group(hash);
+        for (std::size_t step = 1;; step++) {
+            Group g(ctrl.get() + group * GROUP_WIDTH);
+            for (std::uint32_t mask = g.match(h2); mask != 0; mask &= mask - 1) {
+                std::size_t index = group * GROUP_WIDTH + lowest_bit(mask);
+                if (key_equal(slots[index].first, key))
+                    return index;
+            }
+            if (g.match_empty() != 0)
+                return NPOS;
+            group = (group + step) & group_mask;
+        }
+    }
+
+    //returns index of the first non-full slot on the probe sequence of hash
+    std::size_t find_free(std::size_t hash) const {
+        const std::size_t group_mask = capacity / GROUP_WIDTH - 1;
+        std::size_t group = first_group(hash);
+        for (std::size_t step = 1;; step++) {
+            std::uint32_t mask = Group(ctrl.get() + group * GROUP_WIDTH).match_free();
+            if (mask != 0)
+                return group * GROUP_WIDTH + lowest_bit(mask);
+            group = (group + step) & group_mask;
+        }
+    }
+
+    //probes stop at the first group holding an empty slot, so a slot in such a group
+    //can become empty again; otherwise a tombstone keeps later probe sequences intact
+    void erase_at(std::size_t index) {
+        slots[index].~Slot();
+        amount--;
+        if (Group(ctrl.get() + (index & ~(GROUP_WIDTH - 1))).match_empty() != 0) {
+            ctrl[index] = CTRL_EMPTY;
+            growth_left++;
+        } else
+            ctrl[index] = CTRL_DELETED;
+    }
+
+    void shrink_table() {
+        std::size_t new_capacity = std::max(capacity_for(amount * 2), min_capacity);
+        if (amount < capacity / 8 && new_capacity < capacity)
+            rehash(new_capacity);
+    }
+
+    //returns pointer to the value of the key and true if it was created from args, args are untouched otherwise
+    template<class K, class... Args>
+    std::pair<TValue *, bool> emplace_hashed(K &&key, std::size_t hash, Args &&... args) {
+        std::size_t index = find_index(key, hash);
+        if (index != NPOS)
+            return std::pair<TValue *, bool>(&slots[index].second, false);
+
+        //tombstones use up growth_left too, so the new size counts live entries only
+        if (growth_left == 0)
+            rehash(std::max(capacity_for(amount * 2 + 1), min_capacity));
+
+        index = find_free(hash);
+        new(slots + index) Slot(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                                std::forward_as_tuple(std::forward<Args>(args)...));
+        if (ctrl[index] == CTRL_EMPTY)
+            growth_left--;
+        ctrl[index] = h2_of(hash);
+        amount++;
+        return std::pair<TValue *, bool>(&slots[index].second, true);
+    }
+
+    template<class K, class... Args>
+    std::pair<TValue *, bool> emplace_key(K &&key, Args &&... args) {
+        std::size_t hash = hash_of(key);
+        return emplace_hashed(std::forward<K>(key), hash, std::forward<Args>(args)...);
+    }
+
+    template<class K, class V>
+    void set_hashed(K &&key, std::size_t hash, V &&value) {
+        std::pair<TValue *, bool> place = emplace_hashed(std::forward<K>(key), hash, std::forward<V>(value));
+        if (!place.second)
+            *place.first = std::forward<V>(value);
+    }
+
+    template<class K, class V>
+    void assign(K &&key, V &&value) {
+        std::size_t hash = hash_of(key);
+        set_hashed(std::forward<K>(key), hash, std::forward<V>(value));
+    }
+
+    //hashes a batch of keys and prefetches the first probed group of each: control bytes and slots
+    void prefetch_batch(const TKey *keys, std::size_t batch, std::size_t *hashes) const {
+        for (std::size_t i = 0; i < batch; i++) {
+            hashes[i] = hash_of(keys[i]);
+            if (capacity != 0) {
+                std::size_t group = first_group(hashes[i]) * GROUP_WIDTH;
+                DICTIONARY_PREFETCH(ctrl.get() + group);
+                DICTIONARY_PREFETCH(slots + group);
+            }
+        }
+    }
+
+    void release() {
+        for (std::size_t i = 0; i < capacity; i++)
+            if (ctrl[i] >= 0)
+                slots[i].~Slot();
+        std::allocator<Slot>().deallocate(slots, capacity);
+        slots = nullptr;
+        ctrl.reset();
+    }
+
+    //moves all entries into a table of new_capacity slots, no key comparisons needed
+    void rehash(std::size_t new_capacity) {
+        std::unique_ptr<ctrl_t[]> old_ctrl(new ctrl_t[new_capacity]);
+        Slot *old_slots = std::allocator<Slot>().allocate(new_capacity);
+        std::size_t old_capacity = capacity;
+        std::swap(ctrl, old_ctrl);
+        std::swap(slots, old_slots);
+        capacity = new_capacity;
+        std::fill(ctrl.get(), ctrl.get() + capacity, CTRL_EMPTY);
+
+        for (std::size_t i = 0; i < old_capacity; i++)
+            if (old_ctrl[i] >= 0) {
+                std::size_t hash = hash_of(old_slots[i].first);
+                std::size_t index = find_free(hash);
+                ctrl[index] = h2_of(hash);
+                new(slots + index) Slot(std::move(old_slots[i]));
+                old_slots[i].~Slot();
+            }
+        if (old_slots != nullptr)
+            std::allocator<Slot>().deallocate(old_slots, old_capacity);
+
+        growth_left = capacity - capacity / 8 - amount;
+    }
+
+public:
+    FlatHashDictionary() = default;
+
+    FlatHashDictionary(const FlatHashDictionary &) = delete;
+
+    FlatHashDictionary &operator=(const FlatHashDictionary &) = delete;
+
+    virtual ~FlatHashDictionary() {
+        release();
+    }
+
+    //makes room for count entries without any further rehash
+    void Reserve(std::size_t count) {
+        std::size_t new_capacity = capacity_for(count);
+        min_capacity = std::max(min_capacity, new_capacity);
+        if (new_capacity > capacity)
+            rehash(new_capacity);
+    }
+
+    std::size_t Size() const {
+        return amount;
+    }
+
+    std::size_t BucketCount() const {
+        return capacity;
+    }
+
+    using Dictionary<TKey, TValue>::Get;
+
+    virtual const TValue &Get(const TKey &key) const {
+        std::size_t index = find_index(key, hash_of(key));
+        if (index != NPOS)
+            return slots[index].second;
+
+        throw DictionaryNotFoundException<TKey>(key);
+    }
+
+    virtual const TValue *TryGet(const TKey &key) const {
+        std::size_t index = find_index(key, hash_of(key));
+        return index != NPOS ? &slots[index].second : nullptr;
+    }
+
+    virtual void Set(const TKey &key, const TValue &value) {
+        assign(key, value);
+    }
+
+    void Set(const TKey &key, TValue &&value) {
+        assign(key, std::move(value));
+    }
+
+    void Set(TKey &&key, const TValue &value) {
+        assign(std::move(key), value);
+    }
+
+    void Set(TKey &&key, TValue &&value) {
+        assign(std::move(key), std::move(value));
+    }
+
+    //constructs the value from args only if the key is missing, returns true if it was inserted
+    template<class... Args>
+    bool TryEmplace(const TKey &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...).second;
+    }
+
+    template<class... Args>
+    bool TryEmplace(TKey &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...).second;
+    }
+
+    //returns the value of the key, a missing key is inserted with factory() first
+    template<class Factory>
+    TValue &GetOrInsert(const TKey &key, Factory &&factory) {
+        return *emplace_key(key, DeferredValue<Factory>{factory}).first;
+    }
+
+    //applies fn to the value of the key in place, a missing key is inserted with TValue() first
+    template<class Fn>
+    void Upsert(const TKey &key, Fn &&fn) {
+        fn(*emplace_key(key).first);
+    }
+
+    virtual bool IsSet(const TKey &key) const {
+        return find_index(key, hash_of(key)) != NPOS;
+    }
+
+    //heterogeneous lookup: K is compared with stored keys directly, TKey is built only for the exception
+    template<class K, class = if_transparent<K>>
+    const TValue &Get(const K &key) const {
+        const TValue *value = TryGet(key);
+        if (value != nullptr)
+            return *value;
+
+        throw DictionaryNotFoundException<TKey>(TKey(key));
+    }
+
+    template<class K, class = if_transparent<K>>
+    const TValue *TryGet(const K &key) const {
+        std::size_t index = find_index(key, hash_of(key));
+        return index != NPOS ? &slots[index].second : nullptr;
+    }
+
+    template<class K, class = if_transparent<K>>
+    bool IsSet(const K &key) const {
+        return find_index(key, hash_of(key)) != NPOS;
+    }
+
+    //looks up count keys, prefetching the first probed group of each batch before resolving it;
+    //values[i] receives the value and bit i of found is set for every present key,
+    //found must hold (count + 63) / 64 words; returns the number of present keys
+    std::size_t GetMany(const TKey *keys, std::size_t count, TValue *values, std::uint64_t *found) const {
+        std::fill(found, found + (count + 63) / 64, 0);
+        std::size_t hits = 0;
+        std::size_t hashes[BATCH_SIZE];
+        for (std::size_t from = 0; from < count; from += BATCH_SIZE) {
+            std::size_t batch = std::min(BATCH_SIZE, count - from);
+            prefetch_batch(keys + from, batch, hashes);
+            for (std::size_t i = 0; i < batch; i++) {
+                std::size_t index = find_index(keys[from + i], hashes[i]);
+                if (index != NPOS) {
+                    values[from + i] = slots[index].second;
+                    found[(from + i) / 64] |= std::uint64_t(1) << ((from + i) % 64);
+                    hits++;
+                }
+            }
+        }
+        return hits;
+    }
+
+    void SetMany(const TKey *keys, const TValue *values, std::size_t count) {
+        std::size_t hashes[BATCH_SIZE];
+        for (std::size_t from = 0; from < count; from += BATCH_SIZE) {
+            std::size_t batch = std::min(BATCH_SIZE, count - from);
+            prefetch_batch(keys + from, batch, hashes);
+            for (std::size_t i = 0; i < batch; i++)
+                set_hashed(keys[from + i], hashes[i], values[from + i]);
+        }
+    }
+
+    virtual bool Erase(const TKey &key) {
+        std::size_t index = find_index(key, hash_of(key));
+        if (index == NPOS)
+            return false;
+
+        erase_at(index);
+        shrink_table();
+        return true;
+    }
+
+    virtual std::size_t EraseIf(const std::function<bool(const TKey &, const TValue &)> &predicate) {
+        std::size_t removed = 0;
+        for (std::size_t i = 0; i < capacity; i++)
+            if (ctrl[i] >= 0 && predicate(slots[i].first, slots[i].second)) {
+                erase_at(i);
+                removed++;
+            }
+        shrink_table();
+        return removed;
+    }
+};
+
+template<class TKey, class TValue, class Compare, class NodeAllocator, bool OrderStatistics>
+class TreeDictionary<TKey, TValue, Compare, NodeAllocator, OrderStatistics,
+        typename std::enable_if<(is_comparable<TKey>::value && is_equal<TKey>::value) ||
+                                is_three_way_by<TKey, Compare>::value>::type
+>
+        : Dictionary<TKey, TValue> {
+
+    //subtree size of the order statistics augmentation, plain trees get an empty base
+    struct CountedNode {
+        std::size_t count = 1;
+    };
+
+    struct PlainNode {
+    };
+
+    //AVL-tree node
+    struct DataNode : std::conditional<OrderStatistics, CountedNode, PlainNode>::type {
+        TKey key;
+        TValue val;
+        unsigned char high;
+        DataNode *left;
+        DataNode *right;
+        DataNode *parent;
+
+        template<class K, class... Args>
+        DataNode(K &&k, Args &&... args)
+                : key(std::forward<K>(k)), val(std::forward<Args>(args)...), high(1), left(nullptr), right(nullptr),
+                  parent(nullptr) {}
+    };
+
+    static constexpr bool THREE_WAY = is_three_way_by<TKey, Compare>::value;
+
+    //key order as -1, 0 or 1: one Compare call if it is three-way, "==" and then Compare otherwise
+    template<class A, class B>
+    int order(const A &a, const B &b) const {
+        if constexpr (THREE_WAY) {
+            auto result = comp(a, b);
+            return result < 0 ? -1 : (result == 0 ? 0 : 1);
+        } else
+            return a == b ? 0 : (comp(a, b) ? -1 : 1);
+    }
+
+    template<class A, class B>
+    bool less(const A &a, const B &b) const {
+        if constexpr (THREE_WAY)
+            return comp(a, b) < 0;
+        else
+            return comp(a, b);
+    }
+
+    template<class A, class B>
+    bool same(const A &a, const B &b) const {
+        if constexpr (THREE_WAY)
+            return comp(a, b) == 0;
+        else
+            return a == b;
+    }
+
+    //parent links are kept for in-order stepping, the caller links the returned subtree top
+    static inline void set_left(DataNode *node, DataNode *child) {
+        node->left = child;
+        if (child != nullptr)
+            child->parent = node;
+    }
+
+    static inline void set_right(DataNode *node, DataNode *child) {
+        node->right = child;
+        if (child != nullptr)
+            child->parent = node;
+    }
+
+    inline void set_root(DataNode *node) {
+        root = node;
+        if (root != nullptr)
+            root->parent = nullptr;
+    }
+
+    static DataNode *leftmost(DataNode *node) {
+        while (node != nullptr && node->left != nullptr)
+            node = node->left;
+        return node;
+    }
+
+    static DataNode *rightmost(DataNode *node) {
+        while (node != nullptr && node->right != nullptr)
+            node = node->right;
+        return node;
+    }
+
+    static DataNode *successor(DataNode *node) {
+        if (node->right != nullptr)
+            return leftmost(node->right);
+        while (node->parent != nullptr && node->parent->right == node)
+            node = node->parent;
+        return node->parent;
+    }
+
+    static DataNode *predecessor(DataNode *node) {
+        if (node->left != nullptr)
+            return rightmost(node->left);
+        while (node->parent != nullptr && node->parent->left == node)
+            node = node->parent;
+        return node->parent;
+    }
+
+    //AVL-tree balance pack
+    inline unsigned char height(DataNode *pointer) {
+        return pointer == nullptr ? 0 : pointer->high;
+    }
+
+    inline int height_balance(DataNode *node) {
+        return height(node->right) - height(node->left);
+    }
+
+    //exact size with OrderStatistics, otherwise the fewest nodes an AVL tree of this height can hold; O(log n)
+    std::size_t size_lower_bound() {
+        if constexpr (OrderStatistics)
+            return count(root);
+        std::size_t shorter = 0, taller = 0;
+        for (unsigned char h = 0; h < height(root); h++) {
+            std::size_t next = h == 0 ? 1 : taller + shorter + 1;
+            shorter = taller;
+            taller = next;
+        }
+        return taller;
+    }
+
+    static inline std::size_t count(DataNode *pointer) {
+        if constexpr (OrderStatistics)
+            return pointer == nullptr ? 0 : pointer->count;
+        else
+            return 0;
+    }
+
+    //restores height and, with OrderStatistics, subtree size from the children
+    inline void height_restore(DataNode *node) {
+        unsigned char hl = height(node->left), hr = height(node->right);
+        node->high = (hl > hr ? hl : hr) + 1;
+        if constexpr (OrderStatistics)
+            node->count = count(node->left) + count(node->right) + 1;
+    }
+
+    DataNode *rotate_right(DataNode *node) {
+        DataNode *new_top = node->left;
+        set_left(node, new_top->right);
+        set_right(new_top, node);
+        height_restore(node);
+        height_restore(new_top);
+        return new_top;
+    }
+
+    DataNode *rotate_left(DataNode *node) {
+        DataNode *new_top = node->right;
+        set_right(node, new_top->left);
+        set_left(new_top, node);
+        height_restore(node);
+        height_restore(new_top);
+        return new_top;
+    }
+
+    DataNode *balance(DataNode *node) {
+        height_restore(node);
+        if (height_balance(node) == 2) {
+            if (height_balance(node->right) < 0)
+                set_right(node, rotate_right(node->right));
+            return rotate_left(node);
+        }
+        if (height_balance(node) == -2) {
+            if (height_balance(node->left) > 0)
+                set_left(node, rotate_left(node->left));
+            return rotate_right(node);
+        }
+        return node;
+    }
+
+    //rebalances ancestors of a new leaf going up by parent links, stops as soon as a subtree
+    //keeps its height, which after insertion also happens right after a rotation
+    void rebalance_after_insert(DataNode *node) {
+        while (node != nullptr) {
+            unsigned char old_high = node->high;
+            DataNode *parent = node->parent;
+            bool left_child = parent != nullptr && parent->left == node;
+
+            DataNode *top = balance(node);
+            if (parent == nullptr)
+                set_root(top);
+            else if (left_child)
+                set_left(parent, top);
+            else
+                set_right(parent, top);
+
+            if (top->high == old_high) {
+                if constexpr (OrderStatistics)
+                    for (; parent != nullptr; parent = parent->parent)
+                        parent->count++;
+                return;
+            }
+            node = parent;
+        }
+    }
+
+    DataNode *remove_min(DataNode *node) {
+        if (node->left == nullptr)
+            return node->right;
+        set_left(node, remove_min(node->left));
+        return balance(node);
+    }
+
+    //returns top node of balanced subtree after removal, erased is set if the key was found
+    DataNode *remove(DataNode *pointer, const TKey &key, bool &erased) {
+        if (pointer == nullptr)
+            return nullptr;
+        int direction = order(key, pointer->key);
+        if (direction == 0) {
+            erased = true;
+            DataNode *left = pointer->left, *right = pointer->right;
+            alloc.destroy(pointer);
+            if (right == nullptr)
+                return left;
+
+            DataNode *min = right;
+            while (min->left != nullptr)
+                min = min->left;
+            set_right(min, remove_min(right));
+            set_left(min, left);
+            return balance(min);
+        }
+        if (direction < 0)
+            set_left(pointer, remove(pointer->left, key, erased));
+        else
+            set_right(pointer, remove(pointer->right, key, erased));
+
+        return erased ? balance(pointer) : pointer;
+    }
+
+    //links sorted nodes [from, to) into a perfectly balanced subtree
+    DataNode *build_balanced(DataNode **from, DataNode **to) {
+        if (from == to)
+            return nullptr;
+        DataNode **middle = from + (to - from) / 2;
+        set_left(*middle, build_balanced(from, middle));
+        set_right(*middle, build_balanced(middle + 1, to));
+        height_restore(*middle);
+        return *middle;
+    }
+
+    //builds a perfectly balanced subtree from the next count distinct keys of sorted [it, end),
+    //the last value of a run of equal keys wins
+    template<class It>
+    DataNode *build_sorted(It &it, const It &end, std::size_t count) {
+        if (count == 0)
+            return nullptr;
+        DataNode *left = build_sorted(it, end, count / 2);
+
+        It last = it;
+        while (++it != end && same(it->first, last->first))
+            last = it;
+        DataNode *node = alloc.template create<DataNode>(last->first, last->second);
+
+        set_left(node, left);
+        set_right(node, build_sorted(it, end, count - count / 2 - 1));
+        height_restore(node);
+        return node;
+    }
+
+    //links left, middle and right (keys in this order) into one balanced subtree in O(|hl - hr|)
+    DataNode *join(DataNode *left, DataNode *middle, DataNode *right) {
+        if (height(left) > height(right) + 1) {
+            set_right(left, join(left->right, middle, right));
+            return balance(left);
+        }
+        if (height(right) > height(left) + 1) {
+            set_left(right, join(left, middle, right->left));
+            return balance(right);
+        }
+        set_left(middle, left);
+        set_right(middle, right);
+        height_restore(middle);
+        return middle;
+    }
+
+    //splits subtree of node into keys less than key and the rest in O(log n)
+    void split(DataNode *node, const TKey &key, DataNode *&left, DataNode *&right) {
+        if (node == nullptr) {
+            left = right = nullptr;
+            return;
+        }
+        DataNode *node_left = node->left, *node_right = node->right;
+        if (less(node->key, key)) {
+            DataNode *middle;
+            split(node_right, key, middle, right);
+            left = join(node_left, node, middle);
+        } else {
+            DataNode *middle;
+            split(node_left, key, left, middle);
+            right = join(middle, node, node_right);
+        }
+    }
+
+    //appends the nodes in key order
+    void collect_nodes(std::vector<DataNode *> &nodes) const {
+        std::stack<DataNode *> st;
+        DataNode *pointer = root;
+        while (pointer != nullptr || st.size() != 0) {
+            for (; pointer != nullptr; pointer = pointer->left)
+                st.push(pointer);
+            pointer = st.top();
+            st.pop();
+            nodes.push_back(pointer);
+            pointer = pointer->right;
+        }
+    }
+
+    void destroy_nodes() {
+        std::stack<DataNode *> st;
+        if (root != nullptr)
+            st.push(root);
+
+        while (st.size() != 0) {
+            DataNode *pointer = st.top();
+            st.pop();
+            if (pointer->left != nullptr)
+                st.push(pointer->left);
+            if (pointer->right != nullptr)
+                st.push(pointer->right);
+            alloc.destroy(pointer);
+        }
+        root = nullptr;
+    }
+
+    DataNode *root;
+    Compare comp;
+    NodeAllocator alloc;
+
+    template<class K>
+    using if_transparent = typename std::enable_if<!std::is_same<K, TKey>::value &&
+                                                   is_transparent_functor<Compare>::value>::type;
+
+    //iterative descent: an existing key is returned without any writes to the path,
+    //only a new node goes through rebalancing; second is true if the value was created from args
+    template<class K, class... Args>
+    std::pair<TValue *, bool> emplace_key(K &&key, Args &&... args) {
+        DataNode *parent = nullptr;
+        int direction = 0;
+        for (DataNode *pointer = root; pointer != nullptr;) {
+            direction = order(key, pointer->key);
+            if (direction == 0)
+                return std::pair<TValue *, bool>(&pointer->val, false);
+            parent = pointer;
+            pointer = direction < 0 ? pointer->left : pointer->right;
+        }
+
+        DataNode *node = alloc.template create<DataNode>(std::forward<K>(key), std::forward<Args>(args)...);
+        if (parent == nullptr)
+            set_root(node);
+        else if (direction < 0)
+            set_left(parent, node);
+        else
+            set_right(parent, node);
+        rebalance_after_insert(parent);
+        return std::pair<TValue *, bool>(&node->val, true);
+    }
+
+    template<class K, class V>
+    void assign(K &&key, V &&value) {
+        std::pair<TValue *, bool> place = emplace_key(std::forward<K>(key), std::forward<V>(value));
+        if (!place.second)
+            *place.first = std::forward<V>(value);
+    }
+
+    //returns pointer to data or nullptr if no
+    template<class K>
+    DataNode *find_value(const K &key) const {
+        DataNode *data_pointer = root;
+        while (data_pointer != nullptr) {
+            int direction = order(key, data_pointer->key);
+            if (direction == 0)
+                return data_pointer;
+            if (direction < 0)
+                data_pointer = data_pointer->left;
+            else
+                data_pointer = data_pointer->right;
+        }
+        return nullptr;
+    }
+
+    //first node whose key is not less than key, nullptr if none
+    template<class K>
+    DataNode *lower_node(const K &key) const {
+        DataNode *pointer = root, *found = nullptr;
+        while (pointer != nullptr) {
+            if (less(pointer->key, key))
+                pointer = pointer->right;
+            else {
+                found = pointer;
+                pointer = pointer->left;
+            }
+        }
+        return found;
+    }
+
+    //first node whose key is greater than key, nullptr if none
+    template<class K>
+    DataNode *upper_node(const K &key) const {
+        DataNode *pointer = root, *found = nullptr;
+        while (pointer != nullptr) {
+            if (less(key, pointer->key)) {
+                found = pointer;
+                pointer = pointer->left;
+            } else
+                pointer = pointer->right;
+        }
+        return found;
+    }
+
+public:
+    //bidirectional in-order iterator, dereferences to (key, value); end() is a null node,
+    //stepping back from it goes to the maximum
+    class Iterator {
+        friend class TreeDictionary;
+
+        DataNode *node;
+        const TreeDictionary *tree;
+
+        Iterator(DataNode *pointer, const TreeDictionary *owner)
+                : node(pointer), tree(owner) {}
+
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const TKey &, const TValue &> value_type;
+        typedef std::pair<const TKey &, const TValue &> reference;
+        typedef void pointer;
+        typedef std::ptrdiff_t difference_type;
+
+        Iterator()
+                : node(nullptr), tree(nullptr) {}
+
+        const TKey &Key() const {
+            return node->key;
+        }
+
+        const TValue &Value() const {
+            return node->val;
+        }
+
+        reference operator*() const {
+            return reference(node->key, node->val);
+        }
+
+        Iterator &operator++() {
+            node = successor(node);
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        Iterator &operator--() {
+            node = node == nullptr ? rightmost(tree->root) : predecessor(node);
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            Iterator old = *this;
+            --*this;
+            return old;
+        }
+
+        bool operator==(const Iterator &other) const {
+            return node == other.node;
+        }
+
+        bool operator!=(const Iterator &other) const {
+            return node != other.node;
+        }
+    };
+
+    typedef std::reverse_iterator<Iterator> ReverseIterator;
+
+    TreeDictionary()
+            : root(nullptr) {
+    }
+
+    //nodes are owned by one tree, use PersistentTreeDictionary for cheap copies
+    TreeDictionary(const TreeDictionary &) = delete;
+
+    TreeDictionary &operator=(const TreeDictionary &) = delete;
+
+    ~TreeDictionary() {//delete tree
+        if (!NodeAllocator::BULK_RELEASE || !std::is_trivially_destructible<DataNode>::value)
+            destroy_nodes();
+        alloc.release_all();
+    };
+
+    //replaces the content with (key, value) pairs of [begin, end) sorted by key in O(n) without rotations,
+    //for equal keys the last pair wins; unsorted input falls back to BulkInsert
+    template<class It>
+    void BuildFromSorted(It begin, It end) {
+        //single pass iterators are copied first, both the check and the build walk the input
+        if constexpr (!std::is_base_of<std::forward_iterator_tag,
+                typename std::iterator_traits<It>::iterator_category>::value) {
+            std::vector<std::pair<TKey, TValue>> batch(begin, end);
+            BuildFromSorted(batch.begin(), batch.end());
+            return;
+        }
+
+        std::size_t count = 0;
+        bool sorted = true;
+        for (It it = begin, previous = begin; it != end; previous = it, ++it) {
+            if (it == begin || !same(it->first, previous->first))
+                count++;
+            if (it != begin && less(it->first, previous->first)) {
+                sorted = false;
+                break;
+            }
+        }
+
+        destroy_nodes();
+        if (!sorted) {
+            BulkInsert(begin, end);
+            return;
+        }
+        set_root(build_sorted(begin, end, count));
+    }
+
+    //inserts or updates (key, value) pairs of [begin, end): a large batch is sorted and merged with the tree
+    //in O(n + m log m), then relinked into a balanced tree; a small one is inserted key by key in O(m log n)
+    //without touching the rest of the tree; for equal keys the last pair wins
+    template<class It>
+    void BulkInsert(It begin, It end) {
+        constexpr bool MULTI_PASS = std::is_base_of<std::forward_iterator_tag,
+                typename std::iterator_traits<It>::iterator_category>::value;
+        std::size_t depth = height(root) + 1;
+        //single pass iterators are copied before they can be counted
+        std::vector<std::pair<TKey, TValue>> batch;
+        std::size_t batch_size;
+        if constexpr (MULTI_PASS)
+            batch_size = static_cast<std::size_t>(std::distance(begin, end));
+        else {
+            batch.assign(begin, end);
+            batch_size = batch.size();
+        }
+
+        if (batch_size * depth < size_lower_bound()) {
+            if constexpr (MULTI_PASS)
+                for (It it = begin; it != end; ++it)
+                    assign(it->first, it->second);
+            else
+                for (std::pair<TKey, TValue> &entry : batch)
+                    assign(std::move(entry.first), std::move(entry.second));
+            return;
+        }
+
+        if constexpr (MULTI_PASS)
+            batch.assign(begin, end);
+        std::vector<DataNode *> nodes;
+        collect_nodes(nodes);
+        std::stable_sort(batch.begin(), batch.end(),
+                         [this](const std::pair<TKey, TValue> &a, const std::pair<TKey, TValue> &b) {
+                             return less(a.first, b.first);
+                         });
+
+        std::vector<DataNode *> merged;
+        merged.reserve(nodes.size() + batch.size());
+        std::size_t i = 0;
+        for (std::size_t j = 0; j < batch.size(); j++) {
+            while (i < nodes.size() && less(nodes[i]->key, batch[j].first))
+                merged.push_back(nodes[i++]);
+
+            if (!merged.empty() && same(merged.back()->key, batch[j].first))
+                merged.back()->val = std::move(batch[j].second);
+            else if (i < nodes.size() && same(nodes[i]->key, batch[j].first)) {
+                nodes[i]->val = std::move(batch[j].second);
+                merged.push_back(nodes[i++]);
+            } else
+                merged.push_back(alloc.template create<DataNode>(std::move(batch[j].first),
+                                                                 std::move(batch[j].second)));
+        }
+        merged.insert(merged.end(), nodes.begin() + i, nodes.end());
+
+        set_root(build_balanced(merged.data(), merged.data() + merged.size()));
+    }
+
+    using Dictionary<TKey, TValue>::Get;
+
+    virtual const TValue &Get(const TKey &key) const {
+        DataNode *data = find_value(key);
+        if (data != nullptr)
+            return data->val;
+
+        throw DictionaryNotFoundException<TKey>(key);
+    }
+
+    virtual const TValue *TryGet(const TKey &key) const {
+        DataNode *data = find_value(key);
+        return data != nullptr ? &data->val : nullptr;
+    }
+
+    virtual void Set(const TKey &key, const TValue &value) {
+        assign(key, value);
+    }
+
+    void Set(const TKey &key, TValue &&value) {
+        assign(key, std::move(value));
+    }
+
+    void Set(TKey &&key, const TValue &value) {
+        assign(std::move(key), value);
+    }
+
+    void Set(TKey &&key, TValue &&value) {
+        assign(std::move(key), std::move(value));
+    }
+
+    //constructs the value from args only if the key is missing, returns true if it was inserted
+    template<class... Args>
+    bool TryEmplace(const TKey &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...).second;
+    }
+
+    template<class... Args>
+    bool TryEmplace(TKey &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...).second;
+    }
+
+    //returns the value of the key, a missing key is inserted with factory() first
+    template<class Factory>
+    TValue &GetOrInsert(const TKey &key, Factory &&factory) {
+        return *emplace_key(key, DeferredValue<Factory>{factory}).first;
+    }
+
+    //applies fn to the value of the key in place, a missing key is inserted with TValue() first
+    template<class Fn>
+    void Upsert(const TKey &key, Fn &&fn) {
+        fn(*emplace_key(key).first);
+    }
+
+    virtual bool IsSet(const TKey &key) const {
+        return find_value(key) != nullptr;
+    }
+
+    //heterogeneous lookup: K is compared with stored keys directly, TKey is built only for the exception
+    template<class K, class = if_transparent<K>>
+    const TValue &Get(const K &key) const {
+        DataNode *data = find_value(key);
+        if (data != nullptr)
+            return data->val;
+
+        throw DictionaryNotFoundException<TKey>(TKey(key));
+    }
+
+    template<class K, class = if_transparent<K>>
+    const TValue *TryGet(const K &key) const {
+        DataNode *data = find_value(key);
+        return data != nullptr ? &data->val : nullptr;
+    }
+
+    template<class K, class = if_transparent<K>>
+    bool IsSet(const K &key) const {
+        return find_value(key) != nullptr;
+    }
+
+    Iterator begin() const {
+        return Iterator(leftmost(root), this);
+    }
+
+    Iterator end() const {
+        return Iterator(nullptr, this);
+    }
+
+    ReverseIterator rbegin() const {
+        return ReverseIterator(end());
+    }
+
+    ReverseIterator rend() const {
+        return ReverseIterator(begin());
+    }
+
+    //first entry whose key is not less than key
+    Iterator LowerBound(const TKey &key) const {
+        return Iterator(lower_node(key), this);
+    }
+
+    //first entry whose key is greater than key
+    Iterator UpperBound(const TKey &key) const {
+        return Iterator(upper_node(key), this);
+    }
+
+    //read-only copy with keys in one contiguous array, built in O(n)
+    FrozenDictionary<TKey, TValue, Compare> Freeze() const {
+        return FrozenDictionary<TKey, TValue, Compare>(begin(), end());
+    }
+
+    //order statistics, O(log n), need OrderStatistics = true
+    std::size_t Size() const {
+        static_assert(OrderStatistics, "Size needs the OrderStatistics augmentation");
+        return count(root);
+    }
+
+    //k-th smallest entry counting from 0, end() if k >= Size()
+    Iterator Select(std::size_t k) const {
+        static_assert(OrderStatistics, "Select needs the OrderStatistics augmentation");
+        DataNode *pointer = root;
+        while (pointer != nullptr) {
+            std::size_t left = count(pointer->left);
+            if (k == left)
+                break;
+            if (k < left)
+                pointer = pointer->left;
+            else {
+                k -= left + 1;
+                pointer = pointer->right;
+            }
+        }
+        return Iterator(pointer, this);
+    }
+
+    //number of keys less than key
+    std::size_t Rank(const TKey &key) const {
+        static_assert(OrderStatistics, "Rank needs the OrderStatistics augmentation");
+        std::size_t rank = 0;
+        DataNode *pointer = root;
+        while (pointer != nullptr) {
+            if (less(pointer->key, key)) {
+                rank += count(pointer->left) + 1;
+                pointer = pointer->right;
+            } else
+                pointer = pointer->left;
+        }
+        return rank;
+    }
+
+    //number of keys in [lo, hi)
+    std::size_t CountInRange(const TKey &lo, const TKey &hi) const {
+        static_assert(OrderStatistics, "CountInRange needs the OrderStatistics augmentation");
+        if (!less(lo, hi))
+            return 0;
+        return Rank(hi) - Rank(lo);
+    }
+
+    //moves entries with keys not less than key to right in O(log n), its previous content is dropped;
+    //needs a TRANSFERABLE allocator
+    void Split(const TKey &key, TreeDictionary &right) {
+        static_assert(NodeAllocator::TRANSFERABLE, "Split needs nodes that can move between trees");
+        if (&right == this)
+            return;
+        right.destroy_nodes();
+
+        DataNode *left_root, *right_root;
+        split(root, key, left_root, right_root);
+        set_root(left_root);
+        right.set_root(right_root);
+    }
+
+    //moves all entries of right here, O(log n) if its keys are greater than all keys here,
+    //otherwise falls back to Merge; needs a TRANSFERABLE allocator
+    void Join(TreeDictionary &right) {
+        static_assert(NodeAllocator::TRANSFERABLE, "Join needs nodes that can move between trees");
+        if (&right == this || right.root == nullptr)
+            return;
+        if (root != nullptr && !less(rightmost(root)->key, leftmost(right.root)->key)) {
+            Merge(right);
+            return;
+        }
+
+        DataNode *middle = leftmost(right.root);
+        DataNode *rest = right.remove_min(right.root);
+        right.root = nullptr;
+        set_root(join(root, middle, rest));
+    }
+
+    //moves all entries of other here in O(n + m), values of other win for equal keys
+    void Merge(TreeDictionary &other) {
+        if (&other == this || other.root == nullptr)
+            return;
+
+        std::vector<DataNode *> mine, theirs, merged;
+        collect_nodes(mine);
+        other.collect_nodes(theirs);
+        other.root = nullptr;
+        merged.reserve(mine.size() + theirs.size());
+
+        auto adopt = [this, &other](DataNode *node) {
+            if constexpr (NodeAllocator::TRANSFERABLE)
+                return node;
+            else {
+                DataNode *copy = alloc.template create<DataNode>(std::move(node->key), std::move(node->val));
+                other.alloc.destroy(node);
+                return copy;
+            }
+        };
+
+        std::size_t i = 0, j = 0;
+        while (i < mine.size() && j < theirs.size()) {
+            if (less(mine[i]->key, theirs[j]->key))
+                merged.push_back(mine[i++]);
+            else if (less(theirs[j]->key, mine[i]->key))
+                merged.push_back(adopt(theirs[j++]));
+            else {
+                mine[i]->val = std::move(theirs[j]->val);
+                other.alloc.destroy(theirs[j++]);
+                merged.push_back(mine[i++]);
+            }
+        }
+        merged.insert(merged.end(), mine.begin() + i, mine.end());
+        for (; j < theirs.size(); j++)
+            merged.push_back(adopt(theirs[j]));
+
+        set_root(build_balanced(merged.data(), merged.data() + merged.size()));
+    }
+
+    //calls fn(key, value) for keys in [lo, hi) in order, O(log n + k) without allocations
+    template<class Fn>
+    void ForEachInRange(const TKey &lo, const TKey &hi, Fn &&fn) const {
+        for (DataNode *node = lower_node(lo); node != nullptr && less(node->key, hi); node = successor(node))
+            fn(node->key, node->val);
+    }
+
+    virtual bool Erase(const TKey &key) {
+        bool erased = false;
+        set_root(remove(root, key, erased));
+        return erased;
+    }
+
+    //single in-order pass, survivors are relinked into a balanced tree in O(n)
+    virtual std::size_t EraseIf(const std::function<bool(const TKey &, const TValue &)> &predicate) {
+        std::size_t removed = 0;
+        std::vector<DataNode *> kept;
+        std::stack<DataNode *> st;
+        DataNode *pointer = root;
+        while (pointer != nullptr || st.size() != 0) {
+            for (; pointer != nullptr; pointer = pointer->left)
+                st.push(pointer);
+            pointer = st.top();
+            st.pop();
+
+            DataNode *right = pointer->right;
+            if (predicate(pointer->key, pointer->val)) {
+                alloc.destroy(pointer);
+                removed++;
+            } else
+                kept.push_back(pointer);
+            pointer = right;
+        }
+
+        if (removed != 0)
+            set_root(build_balanced(kept.data(), kept.data() + kept.size()));
+        return removed;
+    }
+};
+
+template<class TKey, class TValue, class Compare>
+class PersistentTreeDictionary<TKey, TValue, Compare,
+        typename std::enable_if<(is_comparable<TKey>::value && is_equal<TKey>::value) ||
+                                is_three_way_by<TKey, Compare>::value>::type
+>
+        : Dictionary<TKey, TValue> {
+
+    struct DataNode;
+    typedef std::shared_ptr<DataNode> NodePtr;
+
+    //AVL-tree node shared between versions, changed in place only while a single version owns it
+    struct DataNode {
+        TKey key;
+        TValue val;
+        unsigned char high;
+        NodePtr left;
+        NodePtr right;
+
+        template<class K, class... Args>
+        explicit DataNode(K &&k, Args &&... args)
+                : key(std::forward<K>(k)), val(std::forward<Args>(args)...), high(1) {}
+    };
+
+    NodePtr root;
+    std::size_t amount = 0;
+    Compare comp;
+
+    static constexpr bool THREE_WAY = is_three_way_by<TKey, Compare>::value;
+
+    template<class A, class B>
+    int order(const A &a, const B &b) const {
+        if constexpr (THREE_WAY) {
+            auto result = comp(a, b);
+            return result < 0 ? -1 : (result == 0 ? 0 : 1);
+        } else
+            return a == b ? 0 : (comp(a, b) ? -1 : 1);
+    }
+
+    template<class K>
+    using if_transparent = typename std::enable_if<!std::is_same<K, TKey>::value &&
+                                                   is_transparent_functor<Compare>::value>::type;
+
+    static inline unsigned char height(const NodePtr &pointer) {
+        return pointer == nullptr ? 0 : pointer->high;
+    }
+
+    //copy on write: a node another version still sees is replaced by a copy before it changes,
+    //so a version without snapshots updates its nodes in place like a plain AVL-tree
+    static DataNode &own(NodePtr &pointer) {
+        if (pointer.use_count() != 1)
+            pointer = std::make_shared<DataNode>(static_cast<const DataNode &>(*pointer));
+        else //the last other owner may have released it from another thread
+            std::atomic_thread_fence(std::memory_order_acquire);
+        return *pointer;
+    }
+
+    static void height_restore(DataNode &node) {
+        unsigned char hl = height(node.left), hr = height(node.right);
+        node.high = (hl > hr ? hl : hr) + 1;
+    }
+
+    static void rotate_left(NodePtr &pointer) {
+        DataNode &node = own(pointer);
+        NodePtr up = std::move(node.right);
+        DataNode &top = own(up);
+        node.right = std::move(top.left);
+        height_restore(node);
+        top.left = std::move(pointer);
+        height_restore(top);
+        pointer = std::move(up);
+    }
+
+    static void rotate_right(NodePtr &pointer) {
+        DataNode &node = own(pointer);
+        NodePtr up = std::move(node.left);
+        DataNode &top = own(up);
+        node.left = std::move(top.right);
+        height_restore(node);
+        top.right = std::move(pointer);
+        height_restore(top);
+        pointer = std::move(up);
+    }
+
+    //pointer is owned, its children are balanced and differ in height by at most 2
+    static void balance(NodePtr &pointer) {
+        height_restore(*pointer);
+        int factor = height(pointer->right) - height(pointer->left);
+        if (factor == 2) {
+            if (height(pointer->right->left) > height(pointer->right->right))
+                rotate_right(pointer->right);
+            rotate_left(pointer);
+        } else if (factor == -2) {
+            if (height(pointer->left->right) > height(pointer->left->left))
+                rotate_left(pointer->left);
+            rotate_right(pointer);
+        }
+    }
+
+    //returns the value of the key, inserted is set if it was created from args;
+    //the search path is owned first, everything off the path stays shared with older versions
+    template<class K, class... Args>
+    TValue *insert(NodePtr &pointer, K &&key, bool &inserted, Args &&... args) {
+        if (pointer == nullptr) {
+            pointer = std::make_shared<DataNode>(std::forward<K>(key), std::forward<Args>(args)...);
+            inserted = true;
+            return &pointer->val;
+        }
+        int direction = order(key, pointer->key);
+        DataNode &node = own(pointer);
+        if (direction == 0)
+            return &node.val;
+
+        TValue *value = insert(direction < 0 ? node.left : node.right, std::forward<K>(key), inserted,
+                               std::forward<Args>(args)...);
+        if (inserted)
+            balance(pointer);
+        return value;
+    }
+
+    //detaches the leftmost node of the subtree
+    static NodePtr remove_min(NodePtr &pointer) {
+        if (pointer->left == nullptr) {
+            NodePtr min = std::move(pointer);
+            pointer = std::move(own(min).right);
+            return min;
+        }
+        NodePtr min = remove_min(own(pointer).left);
+        balance(pointer);
+        return min;
+    }
+
+    //the key must be in the subtree, the path to it is owned first
+    template<class K>
+    void remove(NodePtr &pointer, const K &key) {
+        int direction = order(key, pointer->key);
+        if (direction == 0) {
+            if (pointer->left == nullptr || pointer->right == nullptr) {
+                NodePtr child = pointer->left != nullptr ? pointer->left : pointer->right;
+                pointer = std::move(child);
+                return;
+            }
+            DataNode &node = own(pointer);
+            NodePtr min = remove_min(node.right);
+            DataNode &successor = own(min);
+            successor.left = std::move(node.left);
+            successor.right = std::move(node.right);
+            pointer = std::move(min);
+        } else
+            remove(direction < 0 ? own(pointer).left : own(pointer).right, key);
+        balance(pointer);
+    }
+
+    //builds a perfectly balanced subtree from copies of sorted nodes [from, to)
+    static NodePtr build_balanced(const DataNode **from, const DataNode **to) {
+        if (from == to)
+            return nullptr;
+        const DataNode **middle = from + (to - from) / 2;
+        NodePtr node = std::make_shared<DataNode>((*middle)->key, (*middle)->val);
+        node->left = build_balanced(from, middle);
+        node->right = build_balanced(middle + 1, to);
+        height_restore(*node);
+        return node;
+    }
+
+    //returns pointer to data or nullptr if no, K is TKey or a type Compare is transparent for
+    template<class K>
+    const DataNode *find_value(const K &key) const {
+        const DataNode *data_pointer = root.get();
+        while (data_pointer != nullptr) {
+            int direction = order(key, data_pointer->key);
+            if (direction == 0)
+                return data_pointer;
+            data_pointer = direction < 0 ? data_pointer->left.get() : data_pointer->right.get();
+        }
+        return nullptr;
+    }
+
+    //owns the path to the key, second is true if the value was created from args
+    template<class K, class... Args>
+    std::pair<TValue *, bool> own_key(K &&key, Args &&... args) {
+        bool inserted = false;
+        TValue *value = insert(root, std::forward<K>(key), inserted, std::forward<Args>(args)...);
+        amount += inserted;
+        return std::pair<TValue *, bool>(value, inserted);
+    }
+
+    //an existing key is returned without touching the path
+    template<class K, class... Args>
+    std::pair<const TValue *, bool> emplace_key(K &&key, Args &&... args) {
+        const DataNode *data = find_value(key);
+        if (data != nullptr)
+            return std::pair<const TValue *, bool>(&data->val, false);
+        return own_key(std::forward<K>(key), std::forward<Args>(args)...);
+    }
+
+    template<class K, class V>
+    void assign(K &&key, V &&value) {
+        std::pair<TValue *, bool> place = own_key(std::forward<K>(key), std::forward<V>(value));
+        if (!place.second)
+            *place.first = std::forward<V>(value);
+    }
+
+public:
+    PersistentTreeDictionary() = default;
+
+    //copies share all nodes, O(1)
+    PersistentTreeDictionary(const PersistentTreeDictionary &) = default;
+
+    PersistentTreeDictionary &operator=(const PersistentTreeDictionary &) = default;
+
+    //immutable view of the current version in O(1): later changes of either side copy the nodes
+    //they write to and never touch the nodes the other one sees
+    PersistentTreeDictionary Snapshot() const {
+        return *this;
+    }
+
+    std::size_t Size() const {
+        return amount;
+    }
+
+    using Dictionary<TKey, TValue>::Get;
+
+    virtual const TValue &Get(const TKey &key) const {
+        const DataNode *data = find_value(key);
+        if (data != nullptr)
+            return data->val;
+
+        throw DictionaryNotFoundException<TKey>(key);
+    }
+
+    virtual const TValue *TryGet(const TKey &key) const {
+        const DataNode *data = find_value(key);
+        return data != nullptr ? &data->val : nullptr;
+    }
+
+    virtual void Set(const TKey &key, const TValue &value) {
+        assign(key, value);
+    }
+
+    void Set(const TKey &key, TValue &&value) {
+        assign(key, std::move(value));
+    }
+
+    void Set(TKey &&key, const TValue &value) {
+        assign(std::move(key), value);
+    }
+
+    void Set(TKey &&key, TValue &&value) {
+        assign(std::move(key), std::move(value));
+    }
+
+    //constructs the value from args only if the key is missing, returns true if it was inserted
+    template<class... Args>
+    bool TryEmplace(const TKey &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...).second;
+    }
+
+    template<class... Args>
+    bool TryEmplace(TKey &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...).second;
+    }
+
+    //returns the value of the key, a missing key is inserted with factory() first;
+    //the value may be shared with snapshots, so it is read-only
+    template<class Factory>
+    const TValue &GetOrInsert(const TKey &key, Factory &&factory) {
+        return *emplace_key(key, DeferredValue<Factory>{factory}).first;
+    }
+
+    //applies fn to the value of the key, a missing key is inserted with TValue() first;
+    //a value shared with a snapshot is copied first
+    template<class Fn>
+    void Upsert(const TKey &key, Fn &&fn) {
+        fn(*own_key(key).first);
+    }
+
+    virtual bool IsSet(const TKey &key) const {
+        return find_value(key) != nullptr;
+    }
+
+    //heterogeneous lookup: K is compared with stored keys directly, TKey is built only for the exception
+    template<class K, class = if_transparent<K>>
+    const TValue &Get(const K &key) const {
+        const DataNode *data = find_value(key);
+        if (data != nullptr)
+            return data->val;
+
+        throw DictionaryNotFoundException<TKey>(TKey(key));
+    }
+
+    template<class K, class = if_transparent<K>>
+    const TValue *TryGet(const K &key) const {
+        const DataNode *data = find_value(key);
+        return data != nullptr ? &data->val : nullptr;
+    }
+
+    template<class K, class = if_transparent<K>>
+    bool IsSet(const K &key) const {
+        return find_value(key) != nullptr;
+    }
+
+    virtual bool Erase(const TKey &key) {
+        if (find_value(key) == nullptr)
+            return false;
+        remove(root, key);
+        amount--;
+        return true;
+    }
+
+    //survivors are copied into a new balanced version in O(n), older versions keep their nodes
+    virtual std::size_t EraseIf(const std::function<bool(const TKey &, const TValue &)> &predicate) {
+        std::vector<const DataNode *> kept;
+        std::stack<const DataNode *> st;
+        const DataNode *pointer = root.get();
+        while (pointer != nullptr || st.size() != 0) {
+            for (; pointer != nullptr; pointer = pointer->left.get())
+                st.push(pointer);
+            pointer = st.top();
+            st.pop();
+            if (!predicate(pointer->key, pointer->val))
+                kept.push_back(pointer);
+            pointer = pointer->right.get();
+        }
+
+        std::size_t removed = amount - kept.size();
+        if (removed != 0) {
+            root = build_balanced(kept.data(), kept.data() + kept.size());
+            amount = kept.size();
+        }
+        return removed;
+    }
+};
+
+template<class TKey, class TValue, class Compare>
+class CompactTreeDictionary<TKey, TValue, Compare,
+        typename std::enable_if<(is_comparable<TKey>::value && is_equal<TKey>::value) ||
+                                is_three_way_by<TKey, Compare>::value>::type
+>
+        : Dictionary<TKey, TValue> {
+
+    //AVL-tree node in one vector: 32-bit child indices, the 2 high bits of right_balance keep
+    //balance factor + 1 (right height - left height)
+    struct DataNode {
+        TKey key;
+        TValue val;
+        std::uint32_t left;
+        std::uint32_t right_balance;
+
+        template<class K, class... Args>
+        DataNode(K &&k, Args &&... args)
+                : key(std::forward<K>(k)), val(std::forward<Args>(args)...), left(NIL), right_balance(NIL | EVEN) {}
+    };
+
+    static constexpr std::uint32_t NIL = 0x3FFFFFFF;
+    static constexpr std::uint32_t INDEX_MASK = 0x3FFFFFFF;
+    static constexpr std::uint32_t BALANCE_SHIFT = 30;
+    static constexpr std::uint32_t EVEN = 1u << BALANCE_SHIFT;
+
+    std::vector<DataNode> nodes;
+    std::uint32_t root = NIL;
+    Compare comp;
+
+    static constexpr bool THREE_WAY = is_three_way_by<TKey, Compare>::value;
+
+    template<class A, class B>
+    int order(const A &a, const B &b) const {
+        if constexpr (THREE_WAY) {
+            auto result = comp(a, b);
+            return result < 0 ? -1 : (result == 0 ? 0 : 1);
+        } else
+            return a == b ? 0 : (comp(a, b) ? -1 : 1);
+    }
+
+    template<class K>
+    using if_transparent = typename std::enable_if<!std::is_same<K, TKey>::value &&
+                                                   is_transparent_functor<Compare>::value>::type;
+
+    inline std::uint32_t &left(std::uint32_t node) {
+        return nodes[node].left;
+    }
+
+    inline std::uint32_t right(std::uint32_t node) const {
+        return nodes[node].right_balance & INDEX_MASK;
+    }
+
+    inline void set_right(std::uint32_t node, std::uint32_t child) {
+        nodes[node].right_balance = (nodes[node].right_balance & ~INDEX_MASK) | child;
+    }
+
+    inline int balance(std::uint32_t node) const {
+        return static_cast<int>(nodes[node].right_balance >> BALANCE_SHIFT) - 1;
+    }
+
+    inline void set_balance(std::uint32_t node, int value) {
+        nodes[node].right_balance = (nodes[node].right_balance & INDEX_MASK) |
+                                    (static_cast<std::uint32_t>(value + 1) << BALANCE_SHIFT);
+    }
+
+    std::uint32_t rotate_right(std::uint32_t node) {
+        std::uint32_t new_top = left(node);
+        left(node) = right(new_top);
+        set_right(new_top, node);
+        return new_top;
+    }
+
+    std::uint32_t rotate_left(std::uint32_t node) {
+        std::uint32_t new_top = right(node);
+        set_right(node, left(new_top));
+        left(new_top) = node;
+        return new_top;
+    }
+
+    //node is two levels heavier on the left: rotates it back, lowered is set if the subtree got lower
+    std::uint32_t fix_left_heavy(std::uint32_t node, bool &lowered) {
+        std::uint32_t child = left(node);
+        int child_balance = balance(child);
+        if (child_balance <= 0) {
+            std::uint32_t top = rotate_right(node);
+            set_balance(node, child_balance == 0 ? -1 : 0);
+            set_balance(top, child_balance == 0 ? 1 : 0);
+            lowered = child_balance != 0;
+            return top;
+        }
+        std::uint32_t middle = right(child);
+        int middle_balance = balance(middle);
+        left(node) = rotate_left(child);
+        std::uint32_t top = rotate_right(node);
+        set_balance(node, middle_balance < 0 ? 1 : 0);
+        set_balance(child, middle_balance > 0 ? -1 : 0);
+        set_balance(top, 0);
+        lowered = true;
+        return top;
+    }
+
+    std::uint32_t fix_right_heavy(std::uint32_t node, bool &lowered) {
+        std::uint32_t child = right(node);
+        int child_balance = balance(child);
+        if (child_balance >= 0) {
+            std::uint32_t top = rotate_left(node);
+            set_balance(node, child_balance == 0 ? 1 : 0);
+            set_balance(top, child_balance == 0 ? -1 : 0);
+            lowered = child_balance != 0;
+            return top;
+        }
+        std::uint32_t middle = left(child);
+        int middle_balance = balance(middle);
+        set_right(node, rotate_right(child));
+        std::uint32_t top = rotate_left(node);
+        set_balance(node, middle_balance > 0 ? -1 : 0);
+        set_balance(child, middle_balance < 0 ? 1 : 0);
+        set_balance(top, 0);
+        lowered = true;
+        return top;
+    }
+
+    //returns top index of the subtree after insertion, place gets the index of the key,
+    //grown is set if the subtree got higher
+    template<class K, class... Args>
+    std::uint32_t insert(std::uint32_t node, std::pair<std::uint32_t, bool> &place, bool &grown,
+                         K &&key, Args &&... args) {
+        if (node == NIL) {
+            if (nodes.size() >= NIL)
+                throw std::length_error("CompactTreeDictionary is limited to 2^30 - 1 entries");
+            nodes.emplace_back(std::forward<K>(key), std::forward<Args>(args)...);
+            place = std::pair<std::uint32_t, bool>(static_cast<std::uint32_t>(nodes.size() - 1), true);
+            grown = true;
+            return place.first;
+        }
+        int direction = order(key, nodes[node].key);
+        if (direction == 0) {
+            place = std::pair<std::uint32_t, bool>(node, false);
+            grown = false;
+            return node;
+        }
+
+        bool lowered;
+        if (direction < 0) {
+            std::uint32_t child = insert(left(node), place, grown, std::forward<K>(key), std::forward<Args>(args)...);
+            left(node) = child;
+            if (!grown)
+                return node;
+            grown = balance(node) == 0;
+            if (balance(node) < 0)
+                return fix_left_heavy(node, lowered);
+            set_balance(node, balance(node) - 1);
+        } else {
+            std::uint32_t child = insert(right(node), place, grown, std::forward<K>(key), std::forward<Args>(args)...);
+            set_right(node, child);
+            if (!grown)
+                return node;
+            grown = balance(node) == 0;
+            if (balance(node) > 0)
+                return fix_right_heavy(node, lowered);
+            set_balance(node, balance(node) + 1);
+        }
+        return node;
+    }
+
+    //balance fixing after the left (right) subtree of node got lower, shrunk stays set if node's did
+    std::uint32_t left_shrunk(std::uint32_t node, bool &shrunk) {
+        if (balance(node) > 0)
+            return fix_right_heavy(node, shrunk);
+        set_balance(node, balance(node) + 1);
+        shrunk = balance(node) == 0;
+        return node;
+    }
+
+    std::uint32_t right_shrunk(std::uint32_t node, bool &shrunk) {
+        if (balance(node) < 0)
+            return fix_left_heavy(node, shrunk);
+        set_balance(node, balance(node) - 1);
+        shrunk = balance(node) == 0;
+        return node;
+    }
+
+    //unlinks the minimum of the subtree into min
+    std::uint32_t remove_min(std::uint32_t node, std::uint32_t &min, bool &shrunk) {
+        if (left(node) == NIL) {
+            min = node;
+            shrunk = true;
+            return right(node);
+        }
+        left(node) = remove_min(left(node), min, shrunk);
+        return shrunk ? left_shrunk(node, shrunk) : node;
+    }
+
+    //returns top index of the subtree after unlinking the key into erased, NIL if it was missing
+    std::uint32_t remove(std::uint32_t node, const TKey &key, std::uint32_t &erased, bool &shrunk) {
+        if (node == NIL) {
+            shrunk = false;
+            return NIL;
+        }
+        int direction = order(key, nodes[node].key);
+        if (direction == 0) {
+            erased = node;
+            shrunk = true;
+            if (left(node) == NIL)
+                return right(node);
+            if (right(node) == NIL)
+                return left(node);
+
+            std::uint32_t min;
+            std::uint32_t rest = remove_min(right(node), min, shrunk);
+            left(min) = left(node);
+            set_right(min, rest);
+            set_balance(min, balance(node));
+            return shrunk ? right_shrunk(min, shrunk) : min;
+        }
+        if (direction < 0) {
+            left(node) = remove(left(node), key, erased, shrunk);
+            return shrunk ? left_shrunk(node, shrunk) : node;
+        }
+        set_right(node, remove(right(node), key, erased, shrunk));
+        return shrunk ? right_shrunk(node, shrunk) : node;
+    }
+
+    //moves the last node into the freed slot so the vector stays dense
+    void release(std::uint32_t freed) {
+        std::uint32_t last = static_cast<std::uint32_t>(nodes.size() - 1);
+        if (freed != last) {
+            if (root == last)
+                root = freed;
+            else {
+                std::uint32_t parent = root;
+                for (;;) {
+                    std::uint32_t next = order(nodes[last].key, nodes[parent].key) < 0 ? left(parent) : right(parent);
+                    if (next == last)
+                        break;
+                    parent = next;
+                }
+                if (left(parent) == last)
+                    left(parent) = freed;
+                else
+                    set_right(parent, freed);
+            }
+            nodes[freed] = std::move(nodes[last]);
+        }
+        nodes.pop_back();
+    }
+
+    //balanced subtree of count nodes is ceil(log2(count + 1)) high
+    static int height_of(std::size_t count) {
+        int high = 0;
+        for (; count != 0; count >>= 1)
+            high++;
+        return high;
+    }
+
+    //moves sorted nodes [from, to) of source into target in preorder, so a parent lies next to its left child
+    std::uint32_t build_balanced(std::vector<DataNode> &source, std::vector<DataNode> &target,
+                                 const std::uint32_t *from, const std::uint32_t *to) {
+        if (from == to)
+            return NIL;
+        const std::uint32_t *middle = from + (to - from) / 2;
+        std::uint32_t node = static_cast<std::uint32_t>(target.size());
+        target.push_back(std::move(source[*middle]));
+        std::uint32_t left_top = build_balanced(source, target, from, middle);
+        std::uint32_t right_top = build_balanced(source, target, middle + 1, to);
+
+        target[node].left = left_top;
+        target[node].right_balance = right_top | (static_cast<std::uint32_t>(
+                height_of(to - middle - 1) - height_of(middle - from) + 1) << BALANCE_SHIFT);
+        return node;
+    }
+
+    //in-order indices of the nodes kept by the predicate
+    template<class Predicate>
+    std::vector<std::uint32_t> collect(Predicate &&keep) {
+        std::vector<std::uint32_t> kept;
+        std::stack<std::uint32_t> st;
+        std::uint32_t pointer = root;
+        while (pointer != NIL || st.size() != 0) {
+            for (; pointer != NIL; pointer = left(pointer))
+                st.push(pointer);
+            pointer = st.top();
+            st.pop();
+            if (keep(nodes[pointer]))
+                kept.push_back(pointer);
+            pointer = right(pointer);
+        }
+        return kept;
+    }
+
+    void rebuild(const std::vector<std::uint32_t> &kept) {
+        std::vector<DataNode> target;
+        target.reserve(kept.size());
+        root = build_balanced(nodes, target, kept.data(), kept.data() + kept.size());
+        nodes.swap(target);
+    }
+
+    //returns index of data or NIL if no, K is TKey or a type Compare is transparent for
+    template<class K>
+    std::uint32_t find_value(const K &key) const {
+        std::uint32_t pointer = root;
+        while (pointer != NIL) {
+            int direction = order(key, nodes[pointer].key);
+            if (direction == 0)
+                return pointer;
+            pointer = direction < 0 ? nodes[pointer].left : right(pointer);
+        }
+        return NIL;
+    }
+
+    //returns index of the key and true if its value was created from args, args are untouched otherwise
+    template<class K, class... Args>
+    std::pair<std::uint32_t, bool> emplace_key(K &&key, Args &&... args) {
+        std::pair<std::uint32_t, bool> place(NIL, false);
+        bool grown = false;
+        root = insert(root, place, grown, std::forward<K>(key), std::forward<Args>(args)...);
+        return place;
+    }
+
+    template<class K, class V>
+    void assign(K &&key, V &&value) {
+        std::pair<std::uint32_t, bool> place = emplace_key(std::forward<K>(key), std::forward<V>(value));
+        if (!place.second)
+            nodes[place.first].val = std::forward<V>(value);
+    }
+
+public:
+    CompactTreeDictionary() = default;
+
+    std::size_t Size() const {
+        return nodes.size();
+    }
+
+    //relays nodes out in preorder of a perfectly balanced tree and drops spare capacity
+    void Rebuild() {
+        rebuild(collect([](const DataNode &) { return true; }));
+    }
+
+    using Dictionary<TKey, TValue>::Get;
+
+    //returned references and pointers stay valid until the next change of the dictionary
+    virtual const TValue &Get(const TKey &key) const {
+        std::uint32_t data = find_value(key);
+        if (data != NIL)
+            return nodes[data].val;
+
+        throw DictionaryNotFoundException<TKey>(key);
+    }
+
+    virtual const TValue *TryGet(const TKey &key) const {
+        std::uint32_t data = find_value(key);
+        return data != NIL ? &nodes[data].val : nullptr;
+    }
+
+    virtual void Set(const TKey &key, const TValue &value) {
+        assign(key, value);
+    }
+
+    void Set(const TKey &key, TValue &&value) {
+        assign(key, std::move(value));
+    }
+
+    void Set(TKey &&key, const TValue &value) {
+        assign(std::move(key), value);
+    }
+
+    void Set(TKey &&key, TValue &&value) {
+        assign(std::move(key), std::move(value));
+    }
+
+    //constructs the value from args only if the key is missing, returns true if it was inserted
+    template<class... Args>
+    bool TryEmplace(const TKey &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...).second;
+    }
+
+    template<class... Args>
+    bool TryEmplace(TKey &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...).second;
+    }
+
+    //returns the value of the key, a missing key is inserted with factory() first
+    template<class Factory>
+    TValue &GetOrInsert(const TKey &key, Factory &&factory) {
+        return nodes[emplace_key(key, DeferredValue<Factory>{factory}).first].val;
+    }
+
+    //applies fn to the value of the key in place, a missing key is inserted with TValue() first
+    template<class Fn>
+    void Upsert(const TKey &key, Fn &&fn) {
+        fn(nodes[emplace_key(key).first].val);
+    }
+
+    virtual bool IsSet(const TKey &key) const {
+        return find_value(key) != NIL;
+    }
+
+    //heterogeneous lookup: K is compared with stored keys directly, TKey is built only for the exception
+    template<class K, class = if_transparent<K>>
+    const TValue &Get(const K &key) const {
+        std::uint32_t data = find_value(key);
+        if (data != NIL)
+            return nodes[data].val;
+
+        throw DictionaryNotFoundException<TKey>(TKey(key));
+    }
+
+    template<class K, class = if_transparent<K>>
+    const TValue *TryGet(const K &key) const {
+        std::uint32_t data = find_value(key);
+        return data != NIL ? &nodes[data].val : nullptr;
+    }
+
+    template<class K, class = if_transparent<K>>
+    bool IsSet(const K &key) const {
+        return find_value(key) != NIL;
+    }
+
+    virtual bool Erase(const TKey &key) {
+        std::uint32_t erased = NIL;
+        bool shrunk = false;
+        root = remove(root, key, erased, shrunk);
+        if (erased == NIL)
+            return false;
+        release(erased);
+        return true;
+    }
+
+    //survivors are moved into a new vector in preorder of a balanced tree, O(n)
+    virtual std::size_t EraseIf(const std::function<bool(const TKey &, const TValue &)> &predicate) {
+        std::vector<std::uint32_t> kept = collect([&predicate](const DataNode &node) {
+            return !predicate(node.key, node.val);
+        });
+        std::size_t removed = nodes.size() - kept.size();
+        if (removed != 0)
+            rebuild(kept);
+        return removed;
+    }
+};
+
+//immutable read-only dictionary: sorted keys are stored in Eytzinger (breadth-first) order in one array,
+//values in a parallel one; lookup is a branchless descent that prefetches four levels ahead
+template<class TKey, class TValue, class Compare>
+class FrozenDictionary {
+    //keys of the implicit tree node k (1-based) are at k - 1, children of k are 2k and 2k + 1
+    std::vector<TKey> keys;
+    std::vector<TValue> vals;
+    Compare comp;
+
+    //descendants of k four levels down start at 16k, the block of 16 keys fits few cache lines
+    static constexpr std::size_t PREFETCH_STRIDE = 16;
+
+    template<class K>
+    using if_transparent = typename std::enable_if<!std::is_same<K, TKey>::value &&
+                                                   is_transparent_functor<Compare>::value>::type;
+
+    template<class A, class B>
+    bool less(const A &a, const B &b) const {
+        if constexpr (is_three_way_by<TKey, Compare>::value)
+            return comp(a, b) < 0;
+        else
+            return comp(a, b);
+    }
+
+    static inline std::size_t trailing_ones(std::size_t k) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<std::size_t>(__builtin_ctzll(~static_cast<unsigned long long>(k)));
+#else
+        std::size_t ones = 0;
+        for (; k & 1; k >>= 1)
+            ones++;
+        return ones;
+#endif
+    }
+
+    //numbers Eytzinger positions of the subtree of k in order, starting from next
+    static void place(std::vector<std::size_t> &order, std::size_t k, std::size_t &next) {
+        if (k > order.size())
+            return;
+        place(order, 2 * k, next);
+        order[k - 1] = next++;
+        place(order, 2 * k + 1, next);
+    }
+
+    //sorted holds iterators to distinct keys in ascending order
+    template<class It>
+    void layout(const std::vector<It> &sorted) {
+        std::vector<std::size_t> order(sorted.size());
+        std::size_t next = 0;
+        place(order, 1, next);
+
+        keys.reserve(sorted.size());
+        vals.reserve(sorted.size());
+        for (std::size_t i : order) {
+            keys.push_back((*sorted[i]).first);
+            vals.push_back((*sorted[i]).second);
+        }
+    }
+
+    //returns index of the key or sorted size if no
+    template<class K>
+    std::size_t find_index(const K &key) const {
+        std::size_t n = keys.size(), k = 1;
+        const TKey *base = keys.data();
+        while (k <= n) {
+            if (PREFETCH_STRIDE * k <= n)
+                DICTIONARY_PREFETCH(base + PREFETCH_STRIDE * k - 1);
+            k = 2 * k + less(base[k - 1], key);
+        }
+        //k went right after the last left turn, that turn was at the lower bound
+        k >>= trailing_ones(k) + 1;
+        if (k == 0 || less(key, base[k - 1]))
+            return n;
+        return k - 1;
+    }
+
+public:
+    FrozenDictionary() = default;
+
+    //builds from (key, value) pairs of [begin, end), for equal keys the last pair wins;
+    //sorted input is laid out in O(n), other input is sorted first
+    template<class It>
+    FrozenDictionary(It begin, It end) {
+        //single pass iterators are copied first, the layout keeps iterators to the input
+        if constexpr (!std::is_base_of<std::forward_iterator_tag,
+                typename std::iterator_traits<It>::iterator_category>::value) {
+            std::vector<std::pair<TKey, TValue>> entries(begin, end);
+            *this = FrozenDictionary(entries.begin(), entries.end());
+            return;
+        }
+
+        std::vector<It> sorted;
+        bool ordered = true;
+        for (It it = begin; it != end && ordered; ++it) {
+            if (!sorted.empty() && !less((*sorted.back()).first, (*it).first)) {
+                if (less((*it).first, (*sorted.back()).first))
+                    ordered = false;
+                else
+                    sorted.back() = it;
+            } else
+                sorted.push_back(it);
+        }
+        if (ordered) {
+            layout(sorted);
+            return;
+        }
+
+        std::vector<std::pair<TKey, TValue>> entries;
+        for (It it = begin; it != end; ++it)
+            entries.emplace_back((*it).first, (*it).second);
+        std::stable_sort(entries.begin(), entries.end(),
+                         [this](const std::pair<TKey, TValue> &a, const std::pair<TKey, TValue> &b) {
+                             return less(a.first, b.first);
+                         });
+        *this = FrozenDictionary(entries.begin(), entries.end());
+    }
+
+    std::size_t Size() const {
+        return keys.size();
+    }
+
+    const TValue &Get(const TKey &key) const {
+        std::size_t index = find_index(key);
+        if (index != keys.size())
+            return vals[index];
+
+        throw DictionaryNotFoundException<TKey>(key);
+    }
+
+    const TValue *TryGet(const TKey &key) const {
+        std::size_t index = find_index(key);
+        return index != keys.size() ? &vals[index] : nullptr;
+    }
+
+    bool IsSet(const TKey &key) const {
+        return find_index(key) != keys.size();
+    }
+
+    template<class MissPolicy>
+    const TValue &Get(const TKey &key) const {
+        return MissPolicy::resolve(TryGet(key), key);
+    }
+
+    template<class K, class = if_transparent<K>>
+    const TValue &Get(const K &key) const {
+        std::size_t index = find_index(key);
+        if (index != keys.size())
+            return vals[index];
+
+        throw DictionaryNotFoundException<TKey>(TKey(key));
+    }
+
+    template<class K, class = if_transparent<K>>
+    const TValue *TryGet(const K &key) const {
+        std::size_t index = find_index(key);
+        return index != keys.size() ? &vals[index] : nullptr;
+    }
+
+    template<class K, class = if_transparent<K>>
+    bool IsSet(const K &key) const {
+        return find_index(key) != keys.size();
+    }
+};
+
+template<class TKey, class TValue, class Compare>
+class BTreeDictionary<TKey, TValue, Compare,
+        typename std::enable_if<is_comparable<TKey>::value && is_equal<TKey>::value>::type
+>
+        : Dictionary<TKey, TValue> {
+private:
+    //keys of a node fill KEY_LINES cache lines
+    static constexpr std::size_t CACHE_LINE = 64;
+    static constexpr std::size_t KEY_LINES = 4;
+    static constexpr std::size_t SLOTS = std::max<std::size_t>(CACHE_LINE * KEY_LINES / sizeof(TKey), 4);
+    static constexpr std::size_t MIN_SLOTS = SLOTS / 2;
+
+    //uninitialized storage for SLOTS objects, the owning node constructs and destroys them
+    template<class T>
+    struct Slots {
+        alignas(T) unsigned char data[SLOTS * sizeof(T)];
+
+        T &operator[](std::size_t i) {
+            return reinterpret_cast<T *>(data)[i];
+        }
+
+        const T &operator[](std::size_t i) const {
+            return reinterpret_cast<const T *>(data)[i];
+        }
+    };
+
+    struct Node {
+        bool leaf;
+        std::size_t count;
+        Slots<TKey> keys;
+
+        explicit Node(bool is_leaf)
+                : leaf(is_leaf), count(0) {}
+    };
+
+    //keys[i] holds vals[i], leaves are linked in key order
+    struct LeafNode : Node {
+        Slots<TValue> vals;
+        LeafNode *next;
+
+        LeafNode()
+                : Node(true), next(nullptr) {}
+    };
+
+    //keys of children[i] are less than keys[i], keys of children[i + 1] are not
+    struct InnerNode : Node {
+        Node *children[SLOTS + 1];
+
+        InnerNode()
+                : Node(false) {}
+    };
+
+    Node *root = nullptr;
+    std::size_t amount = 0;
+    Compare comp;
+
+    //slot helpers, the count first slots are constructed
+    //makes pos unconstructed by shifting [pos, count) one slot right
+    template<class T>
+    static void open_gap(Slots<T> &s, std::size_t count, std::size_t pos) {
+        if (pos == count)
+            return;
+        new(&s[count]) T(std::move(s[count - 1]));
+        for (std::size_t i = count - 1; i > pos; i--)
+            s[i] = std::move(s[i - 1]);
+        s[pos].~T();
+    }
+
+    //fills unconstructed pos by shifting (pos, count) one slot left
+    template<class T>
+    static void close_gap(Slots<T> &s, std::size_t count, std::size_t pos) {
+        if (pos + 1 == count)
+            return;
+        new(&s[pos]) T(std::move(s[pos + 1]));
+        for (std::size_t i = pos + 1; i + 1 < count; i++)
+            s[i] = std::move(s[i + 1]);
+        s[count - 1].~T();
+    }
+
+    //moves number slots from src into unconstructed dst slots
+    template<class T>
+    static void move_slots(Slots<T> &src, std::size_t from, Slots<T> &dst, std::size_t to, std::size_t number) {
+        for (std::size_t i = 0; i < number; i++) {
+            new(&dst[to + i]) T(std::move(src[from + i]));
+            src[from + i].~T();
+        }
+    }
+
+    static void move_children(InnerNode *src, std::size_t from, InnerNode *dst, std::size_t to, std::size_t number) {
+        std::copy(src->children + from, src->children + from + number, dst->children + to);
+    }
+
+    //first position whose key is not less than key
+    template<class K>
+    std::size_t lower_pos(const Node *node, const K &key) const {
+        std::size_t lo = 0, hi = node->count;
+        while (lo < hi) {
+            std::size_t mid = (lo + hi) / 2;
+            if (comp(node->keys[mid], key))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    //first position whose key is greater than key
+    template<class K>
+    std::size_t upper_pos(const Node *node, const K &key) const {
+        std::size_t lo = 0, hi = node->count;
+        while (lo < hi) {
+            std::size_t mid = (lo + hi) / 2;
+            if (comp(key, node->keys[mid]))
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        return lo;
+    }
+
+    template<class K>
+    using if_transparent = typename std::enable_if<!std::is_same<K, TKey>::value &&
+                                                   is_transparent_functor<Compare>::value>::type;
+
+    //returns pointer to data or nullptr if no, K is TKey or a type Compare is transparent for
+    template<class K>
+    const TValue *find_value(const K &key) const {
+        if (root == nullptr)
+            return nullptr;
+
+        const Node *node = root;
+        while (!node->leaf)
+            node = static_cast<const InnerNode *>(node)->children[upper_pos(node, key)];
+
+        const LeafNode *leaf = static_cast<const LeafNode *>(node);
+        std::size_t pos = lower_pos(leaf, key);
+        if (pos < leaf->count && leaf->keys[pos] == key)
+            return &leaf->vals[pos];
+        return nullptr;
+    }
+
+    //constructs an entry in the unconstructed slot at, nothing is left constructed if it throws
+    template<class K, class... Args>
+    static void construct_entry(LeafNode *leaf, std::size_t at, K &&key, Args &&... args) {
+        new(&leaf->keys[at]) TKey(std::forward<K>(key));
+        try {
+            new(&leaf->vals[at]) TValue(std::forward<Args>(args)...);
+        } catch (...) {
+            leaf->keys[at].~TKey();
+            throw;
+        }
+    }
+
+    //moves the entry constructed in slot count to pos, shifting [pos, count) one slot right
+    static TValue *place_entry(LeafNode *leaf, std::size_t pos) {
+        TKey *keys = &leaf->keys[0];
+        TValue *vals = &leaf->vals[0];
+        std::rotate(keys + pos, keys + leaf->count, keys + leaf->count + 1);
+        std::rotate(vals + pos, vals + leaf->count, vals + leaf->count + 1);
+        leaf->count++;
+        return &leaf->vals[pos];
+    }
+
+    //the entry is built in the free tail slot before anything moves, so a throwing constructor
+    //leaves the leaf as it was
+    template<class K, class... Args>
+    TValue *leaf_insert(LeafNode *leaf, std::size_t pos, K &&key, Args &&... args) {
+        construct_entry(leaf, leaf->count, std::forward<K>(key), std::forward<Args>(args)...);
+        return place_entry(leaf, pos);
+    }
+
+    static void inner_insert(InnerNode *inner, std::size_t pos, TKey &&separator, Node *right) {
+        open_gap(inner->keys, inner->count, pos);
+        new(&inner->keys[pos]) TKey(std::move(separator));
+        std::copy_backward(inner->children + pos + 1, inner->children + inner->count + 1,
+                           inner->children + inner->count + 2);
+        inner->children[pos + 1] = right;
+        inner->count++;
+    }
+
+    //inserts into the subtree of node, place gets the value of the key and whether it was created;
+    //returns the new right sibling if node was split, its separator key goes to separator
+    template<class K, class... Args>
+    Node *insert(Node *node, std::optional<TKey> &separator, std::pair<TValue *, bool> &place,
+                 K &&key, Args &&... args) {
+        if (node->leaf) {
+            LeafNode *leaf = static_cast<LeafNode *>(node);
+            std::size_t pos = lower_pos(leaf, key);
+            if (pos < leaf->count && leaf->keys[pos] == key) {
+                place = std::pair<TValue *, bool>(&leaf->vals[pos], false);
+                return nullptr;
+            }
+            if (leaf->count < SLOTS) {
+                place = std::pair<TValue *, bool>(leaf_insert(leaf, pos, std::forward<K>(key),
+                                                              std::forward<Args>(args)...), true);
+                return nullptr;
+            }
+
+            //the new entry is built in the slot of right that stays free after the split,
+            //the leaf is split and linked only once it exists
+            LeafNode *right = new LeafNode();
+            std::size_t half = SLOTS / 2;
+            try {
+                construct_entry(right, SLOTS - half, std::forward<K>(key), std::forward<Args>(args)...);
+            } catch (...) {
+                delete right;
+                throw;
+            }
+            move_slots(leaf->keys, half, right->keys, 0, SLOTS - half);
+            move_slots(leaf->vals, half, right->vals, 0, SLOTS - half);
+            leaf->count = half;
+            right->count = SLOTS - half;
+
+            TValue *value;
+            if (pos <= half) {
+                move_slots(right->keys, SLOTS - half, leaf->keys, half, 1);
+                move_slots(right->vals, SLOTS - half, leaf->vals, half, 1);
+                value = place_entry(leaf, pos);
+            } else
+                value = place_entry(right, pos - half);
+            right->next = leaf->next;
+            leaf->next = right;
+            place = std::pair<TValue *, bool>(value, true);
+            separator.emplace(right->keys[0]);
+            return right;
+        }
+
+        InnerNode *inner = static_cast<InnerNode *>(node);
+        std::size_t pos = upper_pos(inner, key);
+        std::optional<TKey> child_separator;
+        Node *child_right = insert(inner->children[pos], child_separator, place,
+                                   std::forward<K>(key), std::forward<Args>(args)...);
+        if (child_right == nullptr)
+            return nullptr;
+        if (inner->count < SLOTS) {
+            inner_insert(inner, pos, std::move(*child_separator), child_right);
+            return nullptr;
+        }
+
+        //keys[mid] goes up, the keys after it and their children go to the new node
+        InnerNode *right = new InnerNode();
+        std::size_t mid = SLOTS / 2;
+        move_slots(inner->keys, mid + 1, right->keys, 0, SLOTS - mid - 1);
+        move_children(inner, mid + 1, right, 0, SLOTS - mid);
+        right->count = SLOTS - mid - 1;
+        separator.emplace(std::move(inner->keys[mid]));
+        inner->keys[mid].~TKey();
+        inner->count = mid;
+
+        if (pos <= mid)
+            inner_insert(inner, pos, std::move(*child_separator), child_right);
+        else
+            inner_insert(right, pos - mid - 1, std::move(*child_separator), child_right);
+        return right;
+    }
+
+    template<class K, class... Args>
+    std::pair<TValue *, bool> emplace_key(K &&key, Args &&... args) {
+        std::pair<TValue *, bool> place(nullptr, false);
+        if (root == nullptr)
+            root = new LeafNode();
+
+        std::optional<TKey> separator;
+        Node *right = insert(root, separator, place, std::forward<K>(key), std::forward<Args>(args)...);
+        if (right != nullptr) {
+            InnerNode *new_root = new InnerNode();
+            new(&new_root->keys[0]) TKey(std::move(*separator));
+            new_root->children[0] = root;
+            new_root->children[1] = right;
+            new_root->count = 1;
+            root = new_root;
+        }
+        if (place.second)
+            amount++;
+        return place;
+    }
+
+    template<class K, class V>
+    void assign(K &&key, V &&value) {
+        std::pair<TValue *, bool> place = emplace_key(std::forward<K>(key), std::forward<V>(value));
+        if (!place.second)
+            *place.first = std::forward<V>(value);
+    }
+
+    //deletes a single node with its keys and values, children are not touched
+    static void destroy_node(Node *node) {
+        for (std::size_t i = 0; i < node->count; i++)
+            node->keys[i].~TKey();
+        if (node->leaf) {
+            LeafNode *leaf = static_cast<LeafNode *>(node);
+            for (std::size_t i = 0; i < leaf->count; i++)
+                leaf->vals[i].~TValue();
+            delete leaf;
+        } else
+            delete static_cast<InnerNode *>(node);
+    }
+
+    static void destroy_tree(Node *node) {
+        if (node == nullptr)
+            return;
+        if (!node->leaf) {
+            InnerNode *inner = static_cast<InnerNode *>(node);
+            for (std::size_t i = 0; i <= inner->count; i++)
+                destroy_tree(inner->children[i]);
+        }
+        destroy_node(node);
+    }
+
+    //underflow fixing after erase: child pos of parent has MIN_SLOTS - 1 keys
+    void borrow_from_left(InnerNode *parent, std::size_t pos) {
+        Node *child = parent->children[pos];
+        Node *left = parent->children[pos - 1];
+        open_gap(child->keys, child->count, 0);
+        if (child->leaf) {
+            LeafNode *leaf = static_cast<LeafNode *>(child), *left_leaf = static_cast<LeafNode *>(left);
+            open_gap(leaf->vals, leaf->count, 0);
+            move_slots(left_leaf->keys, left->count - 1, leaf->keys, 0, 1);
+            move_slots(left_leaf->vals, left->count - 1, leaf->vals, 0, 1);
+            parent->keys[pos - 1] = leaf->keys[0];
+        } else {
+            InnerNode *inner = static_cast<InnerNode *>(child), *left_inner = static_cast<InnerNode *>(left);
+            new(&inner->keys[0]) TKey(std::move(parent->keys[pos - 1]));
+            parent->keys[pos - 1] = std::move(left->keys[left->count - 1]);
+            left->keys[left->count - 1].~TKey();
+            std::copy_backward(inner->children, inner->children + inner->count + 1,
+                               inner->children + inner->count + 2);
+            inner->children[0] = left_inner->children[left->count];
+        }
+        child->count++;
+        left->count--;
+    }
+
+    void borrow_from_right(InnerNode *parent, std::size_t pos) {
+        Node *child = parent->children[pos];
+        Node *right = parent->children[pos + 1];
+        if (child->leaf) {
+            LeafNode *leaf = static_cast<LeafNode *>(child), *right_leaf = static_cast<LeafNode *>(right);
+            move_slots(right_leaf->keys, 0, leaf->keys, leaf->count, 1);
+            move_slots(right_leaf->vals, 0, leaf->vals, leaf->count, 1);
+            close_gap(right_leaf->keys, right->count, 0);
+            close_gap(right_leaf->vals, right->count, 0);
+            parent->keys[pos] = right->keys[0];
+        } else {
+            InnerNode *inner = static_cast<InnerNode *>(child), *right_inner = static_cast<InnerNode *>(right);
+            new(&inner->keys[inner->count]) TKey(std::move(parent->keys[pos]));
+            inner->children[inner->count + 1] = right_inner->children[0];
+            parent->keys[pos] = std::move(right->keys[0]);
+            right->keys[0].~TKey();
+            close_gap(right->keys, right->count, 0);
+            std::copy(right_inner->children + 1, right_inner->children + right->count + 1, right_inner->children);
+        }
+        child->count++;
+        right->count--;
+    }
+
+    //merges children pos and pos + 1 of parent into the first one
+    void merge(InnerNode *parent, std::size_t pos) {
+        Node *left = parent->children[pos];
+        Node *right = parent->children[pos + 1];
+        if (left->leaf) {
+            LeafNode *left_leaf = static_cast<LeafNode *>(left), *right_leaf = static_cast<LeafNode *>(right);
+            move_slots(right_leaf->keys, 0, left_leaf->keys, left->count, right->count);
+            move_slots(right_leaf->vals, 0, left_leaf->vals, left->count, right->count);
+            left_leaf->next = right_leaf->next;
+            left->count += right->count;
+        } else {
+            InnerNode *left_inner = static_cast<InnerNode *>(left), *right_inner = static_cast<InnerNode *>(right);
+            new(&left->keys[left->count]) TKey(std::move(parent->keys[pos]));
+            move_slots(right->keys, 0, left->keys, left->count + 1, right->count);
+            move_children(right_inner, 0, left_inner, left->count + 1, right->count + 1);
+            left->count += right->count + 1;
+        }
+        right->count = 0;
+        destroy_node(right);
+
+        parent->keys[pos].~TKey();
+        close_gap(parent->keys, parent->count, pos);
+        std::copy(parent->children + pos + 2, parent->children + parent->count + 1, parent->children + pos + 1);
+        parent->count--;
+    }
+
+    void fix_underflow(InnerNode *parent, std::size_t pos) {
+        if (pos > 0 && parent->children[pos - 1]->count > MIN_SLOTS)
+            borrow_from_left(parent, pos);
+        else if (pos < parent->count && parent->children[pos + 1]->count > MIN_SLOTS)
+            borrow_from_right(parent, pos);
+        else if (pos > 0)
+            merge(parent, pos - 1);
+        else
+            merge(parent, pos);
+    }
+
+    //returns true if the key was found; separators equal to erased keys stay valid
+    bool remove(Node *node, const TKey &key) {
+        if (node->leaf) {
+            LeafNode *leaf = static_cast<LeafNode *>(node);
+            std::size_t pos = lower_pos(leaf, key);
+            if (pos == leaf->count || !(leaf->keys[pos] == key))
+                return false;
+
+            leaf->keys[pos].~TKey();
+            leaf->vals[pos].~TValue();
+            close_gap(leaf->keys, leaf->count, pos);
+            close_gap(leaf->vals, leaf->count, pos);
+            leaf->count--;
+            return true;
+        }
+
+        InnerNode *inner = static_cast<InnerNode *>(node);
+        std::size_t pos = upper_pos(inner, key);
+        if (!remove(inner->children[pos], key))
+            return false;
+        if (inner->children[pos]->count < MIN_SLOTS)
+            fix_underflow(inner, pos);
+        return true;
+    }
+
+    //links sorted entries into full leaves and inner levels above them, every node but the root
+    //gets at least MIN_SLOTS keys
+    void build(std::vector<std::pair<TKey, TValue>> &entries) {
+        if (entries.empty())
+            return;
+
+        std::vector<Node *> level;
+        std::vector<const TKey *> level_min;
+        std::size_t leaves = (entries.size() + SLOTS - 1) / SLOTS;
+        LeafNode *previous = nullptr;
+        for (std::size_t i = 0, from = 0; i < leaves; i++) {
+            std::size_t to = entries.size() * (i + 1) / leaves;
+            LeafNode *leaf = new LeafNode();
+            for (; from < to; from++) {
+                new(&leaf->keys[leaf->count]) TKey(std::move(entries[from].first));
+                new(&leaf->vals[leaf->count]) TValue(std::move(entries[from].second));
+                leaf->count++;
+            }
+            if (previous != nullptr)
+                previous->next = leaf;
+            previous = leaf;
+            level.push_back(leaf);
+            level_min.push_back(&leaf->keys[0]);
+        }
+
+        while (level.size() > 1) {
+            std::vector<Node *> upper;
+            std::vector<const TKey *> upper_min;
+            std::size_t inners = (level.size() + SLOTS) / (SLOTS + 1);
+            for (std::size_t i = 0, from = 0; i < inners; i++) {
+                std::size_t to = level.size() * (i + 1) / inners;
+                InnerNode *inner = new InnerNode();
+                inner->children[0] = level[from];
+                for (std::size_t child = from + 1; child < to; child++) {
+                    new(&inner->keys[inner->count]) TKey(*level_min[child]);
+                    inner->children[++inner->count] = level[child];
+                }
+                upper.push_back(inner);
+                upper_min.push_back(level_min[from]);
+                from = to;
+            }
+            level.swap(upper);
+            level_min.swap(upper_min);
+        }
+        root = level[0];
+    }
+
+    LeafNode *first_leaf() const {
+        Node *node = root;
+        while (node != nullptr && !node->leaf)
+            node = static_cast<InnerNode *>(node)->children[0];
+        return static_cast<LeafNode *>(node);
+    }
+
+public:
+    BTreeDictionary() = default;
+
+    BTreeDictionary(const BTreeDictionary &) = delete;
+
+    BTreeDictionary &operator=(const BTreeDictionary &) = delete;
+
+    virtual ~BTreeDictionary() {
+        destroy_tree(root);
+    }
+
+    std::size_t Size() const {
+        return amount;
+    }
+
+    using Dictionary<TKey, TValue>::Get;
+
+    virtual const TValue &Get(const TKey &key) const {
+        const TValue *value = find_value(key);
+        if (value != nullptr)
+            return *value;
+
+        throw DictionaryNotFoundException<TKey>(key);
+    }
+
+    virtual const TValue *TryGet(const TKey &key) const {
+        return find_value(key);
+    }
+
+    virtual void Set(const TKey &key, const TValue &value) {
+        assign(key, value);
+    }
+
+    void Set(const TKey &key, TValue &&value) {
+        assign(key, std::move(value));
+    }
+
+    void Set(TKey &&key, const TValue &value) {
+        assign(std::move(key), value);
+    }
+
+    void Set(TKey &&key, TValue &&value) {
+        assign(std::move(key), std::move(value));
+    }
+
+    //constructs the value from args only if the key is missing, returns true if it was inserted
+    template<class... Args>
+    bool TryEmplace(const TKey &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...).second;
+    }
+
+    template<class... Args>
+    bool TryEmplace(TKey &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...).second;
+    }
+
+    //returns the value of the key, a missing key is inserted with factory() first
+    template<class Factory>
+    TValue &GetOrInsert(const TKey &key, Factory &&factory) {
+        return *emplace_key(key, DeferredValue<Factory>{factory}).first;
+    }
+
+    //applies fn to the value of the key in place, a missing key is inserted with TValue() first
+    template<class Fn>
+    void Upsert(const TKey &key, Fn &&fn) {
+        fn(*emplace_key(key).first);
+    }
+
+    virtual bool IsSet(const TKey &key) const {
+        return find_value(key) != nullptr;
+    }
+
+    //heterogeneous lookup: K is compared with stored keys directly, TKey is built only for the exception
+    template<class K, class = if_transparent<K>>
+    const TValue &Get(const K &key) const {
+        const TValue *value = find_value(key);
+        if (value != nullptr)
+            return *value;
+
+        throw DictionaryNotFoundException<TKey>(TKey(key));
+    }
+
+    template<class K, class = if_transparent<K>>
+    const TValue *TryGet(const K &key) const {
+        return find_value(key);
+    }
+
+    template<class K, class = if_transparent<K>>
+    bool IsSet(const K &key) const {
+        return find_value(key) != nullptr;
+    }
+
+    virtual bool Erase(const TKey &key) {
+        if (root == nullptr || !remove(root, key))
+            return false;
+
+        amount--;
+        if (!root->leaf && root->count == 0) {
+            Node *old_root = root;
+            root = static_cast<InnerNode *>(root)->children[0];
+            destroy_node(old_root);
+        }
+        return true;
+    }
+
+    //marks entries in one pass over the leaf chain, then rebuilds from the survivors in O(n)
+    virtual std::size_t EraseIf(const std::function<bool(const TKey &, const TValue &)> &predicate) {
+        std::vector<bool> erased;
+        erased.reserve(amount);
+        std::size_t removed = 0;
+        for (LeafNode *leaf = first_leaf(); leaf != nullptr; leaf = leaf->next)
+            for (std::size_t i = 0; i < leaf->count; i++) {
+                erased.push_back(predicate(leaf->keys[i], leaf->vals[i]));
+                removed += erased.back();
+            }
+        if (removed == 0)
+            return 0;
+
+        std::vector<std::pair<TKey, TValue>> kept;
+        kept.reserve(amount - removed);
+        std::size_t index = 0;
+        for (LeafNode *leaf = first_leaf(); leaf != nullptr; leaf = leaf->next)
+            for (std::size_t i = 0; i < leaf->count; i++)
+                if (!erased[index++])
+                    kept.emplace_back(std::move(leaf->keys[i]), std::move(leaf->vals[i]));
+
+        destroy_tree(root);
+        root = nullptr;
+        amount = kept.size();
+        build(kept);
+        return removed;
+    }
+};
+
+template<class TKey, class TValue, class Compare>
+class ConcurrentBTreeDictionary<TKey, TValue, Compare,
+        typename std::enable_if<is_comparable<TKey>::value && is_equal<TKey>::value &&
+                                is_atomic_key<TKey>::value>::type
+> {
+    static constexpr std::size_t CACHE_LINE = 64;
+    static constexpr std::size_t KEY_LINES = 4;
+    static constexpr std::size_t SLOTS = std::max<std::size_t>(CACHE_LINE * KEY_LINES / sizeof(TKey), 4);
+
+    //keys are stored as their bytes, so TKey needs no default constructor
+    typedef typename std::conditional<sizeof(TKey) == 1, std::uint8_t,
+            typename std::conditional<sizeof(TKey) == 2, std::uint16_t,
+                    typename std::conditional<sizeof(TKey) == 4, std::uint32_t,
+                            std::uint64_t>::type>::type>::type KeyBits;
+
+    //optimistic lock: an odd version means a writer holds the node, readers remember an even version
+    //and check it is still the same after reading
+    struct Node {
+        std::atomic<std::uint64_t> version{0};
+        const bool leaf;
+        std::atomic<std::size_t> count{0};
+        std::atomic<KeyBits> keys[SLOTS]{};
+
+        explicit Node(bool is_leaf)
+                : leaf(is_leaf) {}
+    };
+
+    //values are immutable heap entries, so readers can copy one after the leaf has changed;
+    //a leaf emptied by Erase is unlinked and retired, an unlinked node keeps an odd version forever
+    struct LeafNode : Node {
+        std::atomic<const TValue *> vals[SLOTS]{};
+
+        LeafNode()
+                : Node(true) {}
+    };
+
+    //keys of children[i] are less than keys[i], keys of children[i + 1] are not
+    struct InnerNode : Node {
+        std::atomic<Node *> children[SLOTS + 1]{};
+
+        InnerNode()
+                : Node(false) {}
+    };
+
+    //epoch based reclamation of replaced value entries and unlinked nodes: every operation announces
+    //the global epoch in its own slot, an object retired at epoch e is freed once every announced epoch
+    //is greater than e; a slot left with retired objects by a thread that stopped writing is drained
+    //by the next reclaim of any other slot
+    static constexpr std::size_t EPOCH_SLOTS = 64;
+    static constexpr std::size_t RECLAIM_BATCH = 64;
+    static constexpr std::size_t SPARE_ENTRIES = 2 * RECLAIM_BATCH;
+    static constexpr std::uint64_t IDLE = ~static_cast<std::uint64_t>(0);
+
+    //the lists belong to whichever thread holds the slot, so retiring takes no lock;
+    //freed value storage is kept in spare for the next Set through the slot
+    struct alignas(CACHE_LINE) EpochSlot {
+        std::atomic<std::uint64_t> epoch{IDLE};
+        std::vector<std::pair<std::uint64_t, const TValue *>> values;
+        std::vector<std::pair<std::uint64_t, Node *>> nodes;
+        std::vector<TValue *> spare;
+        std::size_t reclaim_at = RECLAIM_BATCH;
+    };
+
+    //slots come in blocks, a reader finding every slot busy appends another block instead of waiting;
+    //blocks live until the dictionary is destroyed
+    struct EpochBlock {
+        EpochSlot slots[EPOCH_SLOTS];
+        std::atomic<EpochBlock *> next{nullptr};
+    };
+
+    class EpochGuard {
+        EpochSlot *held;
+
+        bool try_take(const ConcurrentBTreeDictionary &dict, EpochSlot &candidate) {
+            std::uint64_t idle = IDLE;
+            if (!candidate.epoch.compare_exchange_strong(idle, dict.global_epoch.load()))
+                return false;
+            held = &candidate;
+            return true;
+        }
+
+    public:
+        explicit EpochGuard(const ConcurrentBTreeDictionary &dict) {
+            static thread_local std::size_t home = std::hash<std::thread::id>()(std::this_thread::get_id());
+            for (EpochBlock *block = &dict.epoch_slots;; block = dict.next_block(block)) {
+                std::size_t i = 0;
+                while (i < EPOCH_SLOTS && !try_take(dict, block->slots[(home + i) % EPOCH_SLOTS]))
+                    i++;
+                if (i < EPOCH_SLOTS)
+                    break;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        EpochGuard(const EpochGuard &) = delete;
+
+        EpochGuard &operator=(const EpochGuard &) = delete;
+
+        ~EpochGuard() {
+            held->epoch.store(IDLE, std::memory_order_release);
+        }
+
+        EpochSlot &slot() const {
+            return *held;
+        }
+    };
+
+    std::atomic<Node *> root;
+    std::atomic<std::size_t> amount{0};
+    Compare comp;
+
+    mutable EpochBlock epoch_slots;
+    std::atomic<std::uint64_t> global_epoch{0};
+
+    //version lock pack, a false result means the operation restarts from the root
+    static bool read_lock(const Node *node, std::uint64_t &version) {
+        version = node->version.load(std::memory_order_acquire);
+        return (version & 1) == 0;
+    }
+
+    static bool validate(const Node *node, std::uint64_t version) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return node->version.load(std::memory_order_relaxed) == version;
+    }
+
+    static bool upgrade(Node *node, std::uint64_t version) {
+        if (!node->version.compare_exchange_strong(version, version + 1, std::memory_order_acquire))
+            return false;
+        std::atomic_thread_fence(std::memory_order_release);
+        return true;
+    }
+
+    static void write_unlock(Node *node) {
+        node->version.fetch_add(1, std::memory_order_release);
+    }
+
+    //block after the given one, appended if there is none yet
+    EpochBlock *next_block(EpochBlock *block) const {
+        EpochBlock *next = block->next.load();
+        if (next != nullptr)
+            return next;
+        EpochBlock *added = new EpochBlock();
+        if (block->next.compare_exchange_strong(next, added))
+            return added;
+        delete added;
+        return next;
+    }
+
+    static TKey key_at(const Node *node, std::size_t i) {
+        KeyBits bits = node->keys[i].load(std::memory_order_relaxed);
+        alignas(TKey) unsigned char bytes[sizeof(TKey)];
+        std::memcpy(bytes, &bits, sizeof(TKey));
+        return *std::launder(reinterpret_cast<TKey *>(bytes));
+    }
+
+    static void store_key(Node *node, std::size_t i, const TKey &key) {
+        KeyBits bits = 0;
+        std::memcpy(&bits, &key, sizeof(TKey));
+        node->keys[i].store(bits, std::memory_order_relaxed);
+    }
+
+    //count read without a lock may be torn by a writer, it only has to stay in bounds until validation
+    static std::size_t count_of(const Node *node) {
+        return std::min(node->count.load(std::memory_order_relaxed), SLOTS);
+    }
+
+    //first position whose key is not less than key
+    std::size_t lower_pos(const Node *node, std::size_t count, const TKey &key) const {
+        std::size_t lo = 0, hi = count;
+        while (lo < hi) {
+            std::size_t mid = (lo + hi) / 2;
+            if (comp(key_at(node, mid), key))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    //first position whose key is greater than key
+    std::size_t upper_pos(const Node *node, std::size_t count, const TKey &key) const {
+        std::size_t lo = 0, hi = count;
+        while (lo < hi) {
+            std::size_t mid = (lo + hi) / 2;
+            if (comp(key, key_at(node, mid)))
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        return lo;
+    }
+
+    //slot helpers for nodes held by a writer
+    static void move_key(Node *node, std::size_t from, Node *target, std::size_t to) {
+        target->keys[to].store(node->keys[from].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    template<class T>
+    static void move_atomic(const std::atomic<T> &from, std::atomic<T> &to) {
+        to.store(from.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    //descends to the leaf of key and read locks it, false if a writer interfered
+    bool find_leaf(const TKey &key, LeafNode *&leaf, std::uint64_t &version) const {
+        Node *node = root.load(std::memory_order_acquire);
+        if (!read_lock(node, version) || node != root.load(std::memory_order_acquire))
+            return false;
+
+        while (!node->leaf) {
+            InnerNode *inner = static_cast<InnerNode *>(node);
+            Node *child = inner->children[upper_pos(inner, count_of(inner), key)].load(std::memory_order_relaxed);
+            std::uint64_t child_version;
+            if (!validate(inner, version) || !read_lock(child, child_version) || !validate(inner, version))
+                return false;
+            node = child;
+            version = child_version;
+        }
+        leaf = static_cast<LeafNode *>(node);
+        return true;
+    }
+
+    //one optimistic lookup attempt, entry gets the value entry of key or nullptr
+    bool try_find(const TKey &key, const TValue *&entry) const {
+        LeafNode *leaf;
+        std::uint64_t version;
+        if (!find_leaf(key, leaf, version))
+            return false;
+
+        std::size_t count = count_of(leaf);
+        std::size_t pos = lower_pos(leaf, count, key);
+        bool found = pos < count && key_at(leaf, pos) == key;
+        entry = found ? leaf->vals[pos].load(std::memory_order_relaxed) : nullptr;
+        return validate(leaf, version);
+    }
+
+    //the entry stays valid only while the caller holds an EpochGuard
+    const TValue *find(const TKey &key) const {
+        const TValue *entry = nullptr;
+        while (!try_find(key, entry));
+        return entry;
+    }
+
+    //splits a full node held by a writer, the upper half goes to a new right sibling linked into parent
+    void split_leaf(InnerNode *parent, LeafNode *leaf) {
+        LeafNode *right = new LeafNode();
+        std::size_t half = SLOTS / 2;
+        for (std::size_t i = half; i < SLOTS; i++) {
+            move_key(leaf, i, right, i - half);
+            move_atomic(leaf->vals[i], right->vals[i - half]);
+        }
+        right->count.store(SLOTS - half, std::memory_order_relaxed);
+        leaf->count.store(half, std::memory_order_relaxed);
+        link_split(parent, leaf, key_at(right, 0), right);
+    }
+
+    void split_inner(InnerNode *parent, InnerNode *inner) {
+        InnerNode *right = new InnerNode();
+        std::size_t mid = SLOTS / 2;
+        const TKey separator = key_at(inner, mid);
+        for (std::size_t i = mid + 1; i < SLOTS; i++)
+            move_key(inner, i, right, i - mid - 1);
+        for (std::size_t i = mid + 1; i <= SLOTS; i++)
+            move_atomic(inner->children[i], right->children[i - mid - 1]);
+        right->count.store(SLOTS - mid - 1, std::memory_order_relaxed);
+        inner->count.store(mid, std::memory_order_relaxed);
+        link_split(parent, inner, separator, right);
+    }
+
+    //links a new right sibling into a parent held by a writer, or grows a new root over node
+    void link_split(InnerNode *parent, Node *node, const TKey &separator, Node *right) {
+        if (parent == nullptr) {
+            InnerNode *new_root = new InnerNode();
+            store_key(new_root, 0, separator);
+            new_root->children[0].store(node, std::memory_order_relaxed);
+            new_root->children[1].store(right, std::memory_order_relaxed);
+            new_root->count.store(1, std::memory_order_relaxed);
+            root.store(new_root, std::memory_order_release);
+            return;
+        }
+
+        std::size_t count = parent->count.load(std::memory_order_relaxed);
+        std::size_t pos = upper_pos(parent, count, separator);
+        for (std::size_t i = count; i > pos; i--) {
+            move_key(parent, i - 1, parent, i);
+            move_atomic(parent->children[i], parent->children[i + 1]);
+        }
+        store_key(parent, pos, separator);
+        parent->children[pos + 1].store(right, std::memory_order_relaxed);
+        parent->count.store(count + 1, std::memory_order_relaxed);
+    }
+
+    //locks node and its parent for a split, false if either changed since it was read
+    bool lock_for_split(InnerNode *parent, std::uint64_t parent_version, Node *node, std::uint64_t version) {
+        if (parent != nullptr && !upgrade(parent, parent_version))
+            return false;
+        if (!upgrade(node, version)) {
+            if (parent != nullptr)
+                write_unlock(parent);
+            return false;
+        }
+        if (parent == nullptr && node != root.load(std::memory_order_relaxed)) {
+            write_unlock(node);
+            return false;
+        }
+        return true;
+    }
+
+    //one insertion attempt: full inner nodes on the path are split on the way down so a parent always
+    //has room for a separator; replaced gets the old entry of an existing key
+    bool try_insert(const TKey &key, const TValue *entry, const TValue *&replaced) {
+        Node *node = root.load(std::memory_order_acquire);
+        std::uint64_t version;
+        if (!read_lock(node, version) || node != root.load(std::memory_order_acquire))
+            return false;
+        InnerNode *parent = nullptr;
+        std::uint64_t parent_version = 0;
+
+        while (!node->leaf) {
+            InnerNode *inner = static_cast<InnerNode *>(node);
+            if (count_of(inner) == SLOTS) {
+                if (!lock_for_split(parent, parent_version, inner, version))
+                    return false;
+                split_inner(parent, inner);
+                write_unlock(inner);
+                if (parent != nullptr)
+                    write_unlock(parent);
+                return false;
+            }
+
+            Node *child = inner->children[upper_pos(inner, count_of(inner), key)].load(std::memory_order_relaxed);
+            std::uint64_t child_version;
+            if (!validate(inner, version) || !read_lock(child, child_version) || !validate(inner, version))
+                return false;
+            parent = inner;
+            parent_version = version;
+            node = child;
+            version = child_version;
+        }
+
+        LeafNode *leaf = static_cast<LeafNode *>(node);
+        std::size_t count = count_of(leaf);
+        std::size_t pos = lower_pos(leaf, count, key);
+        bool exists = pos < count && key_at(leaf, pos) == key;
+        if (!exists && count == SLOTS) {
+            if (!lock_for_split(parent, parent_version, leaf, version))
+                return false;
+            split_leaf(parent, leaf);
+            write_unlock(leaf);
+            if (parent != nullptr)
+                write_unlock(parent);
+            return false;
+        }
+
+        if (!upgrade(leaf, version))
+            return false;
+        if (exists)
+            replaced = leaf->vals[pos].exchange(entry, std::memory_order_relaxed);
+        else {
+            for (std::size_t i = count; i > pos; i--) {
+                move_key(leaf, i - 1, leaf, i);
+                move_atomic(leaf->vals[i - 1], leaf->vals[i]);
+            }
+            store_key(leaf, pos, key);
+            leaf->vals[pos].store(entry, std::memory_order_relaxed);
+            leaf->count.store(count + 1, std::memory_order_relaxed);
+        }
+        write_unlock(leaf);
+        return true;
+    }
+
+    //one erase attempt, removed gets the entry of the key and emptied is set if the leaf has no keys left
+    bool try_erase(const TKey &key, const TValue *&removed, bool &emptied) {
+        LeafNode *leaf;
+        std::uint64_t version;
+        if (!find_leaf(key, leaf, version))
+            return false;
+
+        std::size_t count = count_of(leaf);
+        std::size_t pos = lower_pos(leaf, count, key);
+        if (pos == count || !(key_at(leaf, pos) == key))
+            return validate(leaf, version);
+
+        if (!upgrade(leaf, version))
+            return false;
+        removed = leaf->vals[pos].load(std::memory_order_relaxed);
+        for (std::size_t i = pos + 1; i < count; i++) {
+            move_key(leaf, i, leaf, i - 1);
+            move_atomic(leaf->vals[i], leaf->vals[i - 1]);
+        }
+        leaf->count.store(count - 1, std::memory_order_relaxed);
+        emptied = count == 1;
+        write_unlock(leaf);
+        return true;
+    }
+
+    //one attempt to unlink the empty leaf of key, with the inner nodes above it that have no other child,
+    //from the lowest ancestor that keeps other children; false if a writer interfered.
+    //Unlinked nodes stay write locked, so optimistic readers holding them restart from the root
+    bool try_prune(EpochSlot &slot, const TKey &key) {
+        std::vector<std::pair<Node *, std::uint64_t>> path;
+        std::vector<std::size_t> branch;
+        Node *node = root.load(std::memory_order_acquire);
+        std::uint64_t version;
+        if (!read_lock(node, version) || node != root.load(std::memory_order_acquire))
+            return false;
+        path.emplace_back(node, version);
+
+        while (!node->leaf) {
+            InnerNode *inner = static_cast<InnerNode *>(node);
+            std::size_t pos = upper_pos(inner, count_of(inner), key);
+            Node *child = inner->children[pos].load(std::memory_order_relaxed);
+            std::uint64_t child_version;
+            if (!validate(inner, version) || !read_lock(child, child_version) || !validate(inner, version))
+                return false;
+            branch.push_back(pos);
+            path.emplace_back(child, child_version);
+            node = child;
+            version = child_version;
+        }
+
+        //counts read here are checked by the upgrades below, which fail if any node changed since
+        std::size_t top = path.size() - 1;
+        while (top > 0 && count_of(path[top - 1].first) == 0)
+            top--;
+        if (count_of(node) != 0 || top == 0)
+            return validate(node, version);
+
+        for (std::size_t i = top - 1; i < path.size(); i++)
+            if (!upgrade(path[i].first, path[i].second)) {
+                for (std::size_t j = top - 1; j < i; j++)
+                    write_unlock(path[j].first);
+                return false;
+            }
+
+        //the child at pos goes with the separator next to it
+        InnerNode *parent = static_cast<InnerNode *>(path[top - 1].first);
+        std::size_t count = parent->count.load(std::memory_order_relaxed);
+        std::size_t pos = branch[top - 1];
+        for (std::size_t i = pos == 0 ? 1 : pos; i < count; i++)
+            move_key(parent, i, parent, i - 1);
+        for (std::size_t i = pos + 1; i <= count; i++)
+            move_atomic(parent->children[i], parent->children[i - 1]);
+        parent->count.store(count - 1, std::memory_order_relaxed);
+
+        for (std::size_t i = top; i < path.size(); i++)
+            retire(slot, path[i].first);
+        //a root left with one child hands the root over to it
+        if (count == 1 && parent == root.load(std::memory_order_relaxed)) {
+            root.store(parent->children[0].load(std::memory_order_relaxed), std::memory_order_release);
+            retire(slot, parent);
+        } else
+            write_unlock(parent);
+        return true;
+    }
+
+    //value entries are built in storage freed through the same slot when there is some
+    template<class... Args>
+    static const TValue *make_entry(EpochSlot &slot, Args &&... args) {
+        TValue *storage;
+        if (slot.spare.empty())
+            storage = std::allocator<TValue>().allocate(1);
+        else {
+            storage = slot.spare.back();
+            slot.spare.pop_back();
+        }
+        try {
+            new(storage) TValue(std::forward<Args>(args)...);
+        } catch (...) {
+            std::allocator<TValue>().deallocate(storage, 1);
+            throw;
+        }
+        return storage;
+    }
+
+    static void free_entry(const TValue *entry) {
+        entry->~TValue();
+        std::allocator<TValue>().deallocate(const_cast<TValue *>(entry), 1);
+    }
+
+    static void free_node(Node *node) {
+        if (node->leaf)
+            delete static_cast<LeafNode *>(node);
+        else
+            delete static_cast<InnerNode *>(node);
+    }
+
+    void retire(EpochSlot &slot, const TValue *entry) {
+        slot.values.emplace_back(global_epoch.load(), entry);
+        if (slot.values.size() + slot.nodes.size() >= slot.reclaim_at)
+            reclaim(slot);
+    }
+
+    void retire(EpochSlot &slot, Node *node) {
+        slot.nodes.emplace_back(global_epoch.load(), node);
+        if (slot.values.size() + slot.nodes.size() >= slot.reclaim_at)
+            reclaim(slot);
+    }
+
+    //frees what no announced epoch can still see; objects held back by a long operation raise
+    //the next threshold, so the scan over all slots stays amortized; idle slots are taken one by one
+    //and drained as well, so retired objects never wait for their own slot to be reused
+    void reclaim(EpochSlot &slot) {
+        global_epoch.fetch_add(1);
+        std::uint64_t oldest = IDLE;
+        for (const EpochBlock *block = &epoch_slots; block != nullptr; block = block->next.load())
+            for (const EpochSlot &other : block->slots)
+                oldest = std::min(oldest, other.epoch.load());
+
+        free_retired(slot, oldest);
+        for (EpochBlock *block = &epoch_slots; block != nullptr; block = block->next.load())
+            for (EpochSlot &other : block->slots) {
+                std::uint64_t idle = IDLE;
+                if (&other == &slot || !other.epoch.compare_exchange_strong(idle, global_epoch.load()))
+                    continue;
+                if (!other.values.empty() || !other.nodes.empty())
+                    free_retired(other, oldest);
+                other.epoch.store(IDLE, std::memory_order_release);
+            }
+    }
+
+    //frees the retired objects of a held slot that are older than oldest
+    void free_retired(EpochSlot &slot, std::uint64_t oldest) {
+        std::size_t kept = 0;
+        for (std::pair<std::uint64_t, const TValue *> &item : slot.values) {
+            if (item.first >= oldest)
+                slot.values[kept++] = item;
+            else if (slot.spare.size() < SPARE_ENTRIES) {
+                item.second->~TValue();
+                slot.spare.push_back(const_cast<TValue *>(item.second));
+            } else
+                free_entry(item.second);
+        }
+        slot.values.resize(kept);
+
+        kept = 0;
+        for (std::pair<std::uint64_t, Node *> &item : slot.nodes) {
+            if (item.first >= oldest)
+                slot.nodes[kept++] = item;
+            else
+                free_node(item.second);
+        }
+        slot.nodes.resize(kept);
+        slot.reclaim_at = std::max(RECLAIM_BATCH, 2 * (slot.values.size() + slot.nodes.size()));
+    }
+
+    static void destroy_tree(Node *node) {
+        if (node->leaf) {
+            LeafNode *leaf = static_cast<LeafNode *>(node);
+            for (std::size_t i = 0; i < count_of(leaf); i++)
+                free_entry(leaf->vals[i].load(std::memory_order_relaxed));
+            delete leaf;
+            return;
+        }
+        InnerNode *inner = static_cast<InnerNode *>(node);
+        for (std::size_t i = 0; i <= count_of(inner); i++)
+            destroy_tree(inner->children[i].load(std::memory_order_relaxed));
+        delete inner;
+    }
+
+public:
+    ConcurrentBTreeDictionary()
+            : root(new LeafNode()) {}
+
+    ConcurrentBTreeDictionary(const ConcurrentBTreeDictionary &) = delete;
+
+    ConcurrentBTreeDictionary &operator=(const ConcurrentBTreeDictionary &) = delete;
+
+    //no other thread may use the dictionary anymore
+    ~ConcurrentBTreeDictionary() {
+        destroy_tree(root.load());
+        for (EpochBlock *block = &epoch_slots; block != nullptr; block = block->next.load())
+            for (EpochSlot &slot : block->slots) {
+                for (std::pair<std::uint64_t, const TValue *> &item : slot.values)
+                    free_entry(item.second);
+                for (std::pair<std::uint64_t, Node *> &item : slot.nodes)
+                    free_node(item.second);
+                for (TValue *storage : slot.spare)
+                    std::allocator<TValue>().deallocate(storage, 1);
+            }
+        for (EpochBlock *block = epoch_slots.next.load(); block != nullptr;) {
+            EpochBlock *next = block->next.load();
+            delete block;
+            block = next;
+        }
+    }
+
+    std::size_t Size() const {
+        return amount.load(std::memory_order_relaxed);
+    }
+
+    //values are returned by copy: a reference could outlive the entry once another thread replaces it
+    TValue Get(const TKey &key) const {
+        EpochGuard guard(*this);
+        const TValue *entry = find(key);
+        if (entry != nullptr)
+            return *entry;
+
+        throw DictionaryNotFoundException<TKey>(key);
+    }
+
+    bool TryGet(const TKey &key, TValue &value) const {
+        EpochGuard guard(*this);
+        const TValue *entry = find(key);
+        if (entry == nullptr)
+            return false;
+        value = *entry;
+        return true;
+    }
+
+    bool IsSet(const TKey &key) const {
+        EpochGuard guard(*this);
+        return find(key) != nullptr;
+    }
+
+    //writers hold a guard too: a node they pass may be unlinked and retired meanwhile
+    void Set(const TKey &key, const TValue &value) {
+        EpochGuard guard(*this);
+        const TValue *entry = make_entry(guard.slot(), value);
+        const TValue *replaced = nullptr;
+        while (!try_insert(key, entry, replaced));
+        if (replaced != nullptr)
+            retire(guard.slot(), replaced);
+        else
+            amount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool Erase(const TKey &key) {
+        EpochGuard guard(*this);
+        const TValue *removed = nullptr;
+        bool emptied = false;
+        while (!try_erase(key, removed, emptied));
+        if (removed == nullptr)
+            return false;
+        retire(guard.slot(), removed);
+        amount.fetch_sub(1, std::memory_order_relaxed);
+        if (emptied)
+            while (!try_prune(guard.slot(), key));
+        return true;
+    }
+};
+
+template<class TKey, class TValue, class KeyEqual, class NodeAllocator, class Reorder>
+class ListDictionary<TKey, TValue, KeyEqual, NodeAllocator, Reorder,
+        typename std::enable_if<is_equal<TKey>::value>::type
+>
+        : public Dictionary<TKey, TValue> {
+
+private:
+    //Linkedlist node
+    struct DataNode : Reorder::NodeData {
+        TKey key;
+        TValue val;
+        DataNode *next;
+
+        template<class K, class... Args>
+        DataNode(K &&k, Args &&... args)
+                : key(std::forward<K>(k)), val(std::forward<Args>(args)...), next(nullptr) {}
+    };
+
+    DataNode *root = nullptr;
+    KeyEqual key_equal;
+    NodeAllocator alloc;
+
+    template<class K>
+    using if_transparent = typename std::enable_if<!std::is_same<K, TKey>::value &&
+                                                   is_transparent_functor<KeyEqual>::value>::type;
+
+    template<class K, class... Args>
+    std::pair<TValue *, bool> emplace_key(K &&key, Args &&... args) {
+        DataNode **prev_link;
+        DataNode **link = find_link(key, prev_link);
+        DataNode *pointer = *link;
+        if (pointer != nullptr) {
+            Reorder::hit(root, link, prev_link);
+            return std::pair<TValue *, bool>(&pointer->val, false);
+        }
+
+        pointer = alloc.template create<DataNode>(std::forward<K>(key), std::forward<Args>(args)...);
+        if constexpr (Reorder::INSERT_AT_END)
+            *link = pointer;
+        else {
+            pointer->next = root;
+            root = pointer;
+        }
+        return std::pair<TValue *, bool>(&pointer->val, true);
+    }
+
+    template<class K, class V>
+    void assign(K &&key, V &&value) {
+        std::pair<TValue *, bool> place = emplace_key(std::forward<K>(key), std::forward<V>(value));
+        if (!place.second)
+            *place.first = std::forward<V>(value);
+    }
+
+    //returns the link holding the key or the null link after the last node,
+    //prev_link gets the link holding the previous node
+    template<class K>
+    DataNode **find_link(const K &key, DataNode **&prev_link) {
+        prev_link = nullptr;
+        DataNode **link = &root;
+        while (*link != nullptr && !key_equal((*link)->key, key)) {
+            prev_link = link;
+            link = &(*link)->next;
+        }
+        return link;
+    }
+
+    //plain scan, the list is left as it is
+    template<class K>
+    const DataNode *find_value(const K &key) const {
+        const DataNode *pointer = root;
+        while (pointer != nullptr && !key_equal(pointer->key, key))
+            pointer = pointer->next;
+        return pointer;
+    }
+
+    //scan that lets Reorder move the found node
+    template<class K>
+    TValue *find_reorder(const K &key) {
+        if constexpr (!Reorder::REORDERS) {
+            const DataNode *pointer = find_value(key);
+            return pointer != nullptr ? const_cast<TValue *>(&pointer->val) : nullptr;
+        } else {
+            DataNode **prev_link;
+            DataNode **link = find_link(key, prev_link);
+            DataNode *pointer = *link;
+            if (pointer == nullptr)
+                return nullptr;
+            Reorder::hit(root, link, prev_link);
+            return &pointer->val;
+        }
+    }
+
+public:
+    ListDictionary() = default;
+
+    ~ListDictionary() {
+        if (!NodeAllocator::BULK_RELEASE || !std::is_trivially_destructible<DataNode>::value) {
+            std::stack<DataNode *> st;
+            if (root != nullptr)
+                st.push(root);
+            while (st.size() != 0) {
+                DataNode *pointer = st.top();
+                st.pop();
+                if (pointer->next != nullptr)
+                    st.push(pointer->next);
+                alloc.destroy(pointer);
+            }
+        }
+        alloc.release_all();
+    }
+
+    using Dictionary<TKey, TValue>::Get;
+
+    virtual const TValue &Get(const TKey &key) const {
+        const DataNode *pointer = find_value(key);
+        if (pointer != nullptr)
+            return pointer->val;
+
+        throw DictionaryNotFoundException<TKey>(key);
+    }
+
+    virtual const TValue *TryGet(const TKey &key) const {
+        const DataNode *pointer = find_value(key);
+        return pointer != nullptr ? &pointer->val : nullptr;
+    }
+
+    virtual void Set(const TKey &key, const TValue &value) {
+        assign(key, value);
+    }
+
+    void Set(const TKey &key, TValue &&value) {
+        assign(key, std::move(value));
+    }
+
+    void Set(TKey &&key, const TValue &value) {
+        assign(std::move(key), value);
+    }
+
+    void Set(TKey &&key, TValue &&value) {
+        assign(std::move(key), std::move(value));
+    }
+
+    //constructs the value from args only if the key is missing, returns true if it was inserted
+    template<class... Args>
+    bool TryEmplace(const TKey &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...).second;
+    }
+
+    template<class... Args>
+    bool TryEmplace(TKey &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...).second;
+    }
+
+    //returns the value of the key, a missing key is inserted with factory() first
+    template<class Factory>
+    TValue &GetOrInsert(const TKey &key, Factory &&factory) {
+        return *emplace_key(key, DeferredValue<Factory>{factory}).first;
+    }
+
+    //applies fn to the value of the key in place, a missing key is inserted with TValue() first
+    template<class Fn>
+    void Upsert(const TKey &key, Fn &&fn) {
+        fn(*emplace_key(key).first);
     }
 
     virtual bool IsSet(const TKey &key) const {
         return find_value(key) != nullptr;
     }
+
+    //returns pointer to the value or nullptr if no; unlike the const lookups it lets Reorder
+    //move the found key closer to the head, so it is what a self-organizing list is searched with
+    TValue *Find(const TKey &key) {
+        return find_reorder(key);
+    }
+
+    template<class K, class = if_transparent<K>>
+    TValue *Find(const K &key) {
+        return find_reorder(key);
+    }
+
+    //heterogeneous lookup: K is compared with stored keys directly, TKey is built only for the exception
+    template<class K, class = if_transparent<K>>
+    const TValue &Get(const K &key) const {
+        const DataNode *pointer = find_value(key);
+        if (pointer != nullptr)
+            return pointer->val;
+
+        throw DictionaryNotFoundException<TKey>(TKey(key));
+    }
+
+    template<class K, class = if_transparent<K>>
+    const TValue *TryGet(const K &key) const {
+        const DataNode *pointer = find_value(key);
+        return pointer != nullptr ? &pointer->val : nullptr;
+    }
+
+    template<class K, class = if_transparent<K>>
+    bool IsSet(const K &key) const {
+        return find_value(key) != nullptr;
+    }
+
+    virtual bool Erase(const TKey &key) {
+        for (DataNode **link = &root; *link != nullptr; link = &(*link)->next)
+            if (key_equal((*link)->key, key)) {
+                DataNode *pointer = *link;
+                *link = pointer->next;
+                alloc.destroy(pointer);
+                return true;
+            }
+        return false;
+    }
+
+    virtual std::size_t EraseIf(const std::function<bool(const TKey &, const TValue &)> &predicate) {
+        std::size_t removed = 0;
+        DataNode **link = &root;
+        while (*link != nullptr)
+            if (predicate((*link)->key, (*link)->val)) {
+                DataNode *pointer = *link;
+                *link = pointer->next;
+                alloc.destroy(pointer);
+                removed++;
+            } else
+                link = &(*link)->next;
+        return removed;
+    }
+};
+
+template<class TKey, class TValue, class KeyEqual>
+class UnrolledListDictionary<TKey, TValue, KeyEqual,
+        typename std::enable_if<is_equal<TKey>::value && is_bytewise_equal<TKey, KeyEqual>::value &&
+                                std::is_trivially_copyable<TKey>::value>::type
+>
+        : public Dictionary<TKey, TValue> {
+
+private:
+    //wrapper keeps std::vector<bool> away from the values
+    struct Slot {
+        TValue val;
+
+        template<class... Args>
+        Slot(std::in_place_t, Args &&... args)
+                : val(std::forward<Args>(args)...) {}
+    };
+
+    //keys and values are parallel arrays, the scan touches only keys
+    std::vector<TKey> keys;
+    std::vector<Slot> vals;
+    KeyEqual key_equal;
+
+    template<class K>
+    using if_transparent = typename std::enable_if<!std::is_same<K, TKey>::value &&
+                                                   is_transparent_functor<KeyEqual>::value>::type;
+
+#ifdef DICTIONARY_HAS_SSE2
+    //key sizes a 16 byte vector holds a whole number of
+    static constexpr bool VECTOR_SCAN = sizeof(TKey) <= 8 && (sizeof(TKey) & (sizeof(TKey) - 1)) == 0;
+    static constexpr std::size_t LANES = 16 / sizeof(TKey);
+
+    static inline std::size_t lowest_bit(std::uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<std::size_t>(__builtin_ctz(mask));
+#else
+        std::size_t pos = 0;
+        while ((mask & 1u) == 0) {
+            mask >>= 1;
+            pos++;
+        }
+        return pos;
+#endif
+    }
+
+    //lanes equal to the needle become all ones: 64-bit lanes need both 32-bit halves equal
+    static inline __m128i equal_lanes(const TKey *pos, __m128i needle) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+        if constexpr (sizeof(TKey) == 1)
+            return _mm_cmpeq_epi8(block, needle);
+        else if constexpr (sizeof(TKey) == 2)
+            return _mm_cmpeq_epi16(block, needle);
+        else if constexpr (sizeof(TKey) == 4)
+            return _mm_cmpeq_epi32(block, needle);
+        else {
+            __m128i halves = _mm_cmpeq_epi32(block, needle);
+            return _mm_and_si128(halves, _mm_shuffle_epi32(halves, _MM_SHUFFLE(2, 3, 0, 1)));
+        }
+    }
+
+    static inline std::uint32_t lane_mask(__m128i lanes) {
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(lanes));
+    }
+#endif
+
+    //index of the key or keys.size() if it is missing
+    std::size_t find_index(const TKey &key) const {
+        const TKey *data = keys.data();
+        std::size_t count = keys.size(), i = 0;
+#ifdef DICTIONARY_HAS_SSE2
+        if constexpr (VECTOR_SCAN) {
+            //the key repeated as raw bytes, TKey itself may have no default constructor
+            unsigned char pattern[16];
+            for (std::size_t lane = 0; lane < LANES; lane++)
+                std::memcpy(pattern + lane * sizeof(TKey), &key, sizeof(TKey));
+            __m128i needle = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+            //64 bytes per iteration with one branch, the exact lane is searched only after a hit
+            for (; i + 4 * LANES <= count; i += 4 * LANES) {
+                __m128i first = equal_lanes(data + i, needle), second = equal_lanes(data + i + LANES, needle);
+                __m128i third = equal_lanes(data + i + 2 * LANES, needle);
+                __m128i fourth = equal_lanes(data + i + 3 * LANES, needle);
+                if (lane_mask(_mm_or_si128(_mm_or_si128(first, second), _mm_or_si128(third, fourth))) != 0) {
+                    std::uint32_t low = lane_mask(first) | lane_mask(second) << 16;
+                    if (low != 0)
+                        return i + lowest_bit(low) / sizeof(TKey);
+                    std::uint32_t high = lane_mask(third) | lane_mask(fourth) << 16;
+                    return i + 2 * LANES + lowest_bit(high) / sizeof(TKey);
+                }
+            }
+            for (; i + LANES <= count; i += LANES) {
+                std::uint32_t mask = lane_mask(equal_lanes(data + i, needle));
+                if (mask != 0)
+                    return i + lowest_bit(mask) / sizeof(TKey);
+            }
+        }
+#endif
+        for (; i < count; i++)
+            if (std::memcmp(data + i, &key, sizeof(TKey)) == 0)
+                return i;
+        return count;
+    }
+
+    //a heterogeneous key has other bytes than an equal TKey, so it is compared through KeyEqual
+    template<class K>
+    std::size_t find_index(const K &key) const {
+        std::size_t count = keys.size();
+        for (std::size_t i = 0; i < count; i++)
+            if (key_equal(keys[i], key))
+                return i;
+        return count;
+    }
+
+    template<class... Args>
+    std::pair<TValue *, bool> emplace_key(const TKey &key, Args &&... args) {
+        std::size_t index = find_index(key);
+        if (index != keys.size())
+            return std::pair<TValue *, bool>(&vals[index].val, false);
+
+        keys.push_back(key);
+        try {
+            vals.emplace_back(std::in_place, std::forward<Args>(args)...);
+        } catch (...) {
+            keys.pop_back();
+            throw;
+        }
+        return std::pair<TValue *, bool>(&vals.back().val, true);
+    }
+
+    template<class V>
+    void assign(const TKey &key, V &&value) {
+        std::pair<TValue *, bool> place = emplace_key(key, std::forward<V>(value));
+        if (!place.second)
+            *place.first = std::forward<V>(value);
+    }
+
+    //the last entry fills the hole
+    void remove(std::size_t index) {
+        if (index + 1 != keys.size()) {
+            keys[index] = keys.back();
+            vals[index] = std::move(vals.back());
+        }
+        keys.pop_back();
+        vals.pop_back();
+    }
+
+public:
+    UnrolledListDictionary() = default;
+
+    std::size_t Size() const {
+        return keys.size();
+    }
+
+    using Dictionary<TKey, TValue>::Get;
+
+    virtual const TValue &Get(const TKey &key) const {
+        std::size_t index = find_index(key);
+        if (index != keys.size())
+            return vals[index].val;
+
+        throw DictionaryNotFoundException<TKey>(key);
+    }
+
+    virtual const TValue *TryGet(const TKey &key) const {
+        std::size_t index = find_index(key);
+        return index != keys.size() ? &vals[index].val : nullptr;
+    }
+
+    virtual void Set(const TKey &key, const TValue &value) {
+        assign(key, value);
+    }
+
+    void Set(const TKey &key, TValue &&value) {
+        assign(key, std::move(value));
+    }
+
+    //keys are trivially copyable, so the rvalue key forms only select the value overload
+    void Set(TKey &&key, const TValue &value) {
+        assign(key, value);
+    }
+
+    void Set(TKey &&key, TValue &&value) {
+        assign(key, std::move(value));
+    }
+
+    //constructs the value from args only if the key is missing, returns true if it was inserted
+    template<class... Args>
+    bool TryEmplace(const TKey &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...).second;
+    }
+
+    //returns the value of the key, a missing key is inserted with factory() first
+    template<class Factory>
+    TValue &GetOrInsert(const TKey &key, Factory &&factory) {
+        return *emplace_key(key, DeferredValue<Factory>{factory}).first;
+    }
+
+    //applies fn to the value of the key in place, a missing key is inserted with TValue() first
+    template<class Fn>
+    void Upsert(const TKey &key, Fn &&fn) {
+        fn(*emplace_key(key).first);
+    }
+
+    virtual bool IsSet(const TKey &key) const {
+        return find_index(key) != keys.size();
+    }
+
+    //heterogeneous lookup: K is compared with stored keys directly, TKey is built only for the exception
+    template<class K, class = if_transparent<K>>
+    const TValue &Get(const K &key) const {
+        std::size_t index = find_index(key);
+        if (index != keys.size())
+            return vals[index].val;
+
+        throw DictionaryNotFoundException<TKey>(TKey(key));
+    }
+
+    template<class K, class = if_transparent<K>>
+    const TValue *TryGet(const K &key) const {
+        std::size_t index = find_index(key);
+        return index != keys.size() ? &vals[index].val : nullptr;
+    }
+
+    template<class K, class = if_transparent<K>>
+    bool IsSet(const K &key) const {
+        return find_index(key) != keys.size();
+    }
+
+    virtual bool Erase(const TKey &key) {
+        std::size_t index = find_index(key);
+        if (index == keys.size())
+            return false;
+
+        remove(index);
+        return true;
+    }
+
+    virtual std::size_t EraseIf(const std::function<bool(const TKey &, const TValue &)> &predicate) {
+        std::size_t removed = 0, index = 0;
+        while (index < keys.size())
+            if (predicate(keys[index], vals[index].val)) {
+                remove(index);
+                removed++;
+            } else
+                index++;
+        return removed;
+    }
+};
+
+template<class TKey, class TValue, class KeyEqual>
+class UnrolledListDictionary<TKey, TValue, KeyEqual,
+        typename std::enable_if<is_equal<TKey>::value && !(is_bytewise_equal<TKey, KeyEqual>::value &&
+                                                           std::is_trivially_copyable<TKey>::value)>::type
+>
+        : public Dictionary<TKey, TValue> {
+
+private:
+    //about 512 bytes of keys per block
+    static constexpr std::size_t BLOCK_SIZE = std::max<std::size_t>(8, 512 / sizeof(TKey));
+
+    //keys of a block lie together and are compared before the next block is touched,
+    //entries are constructed in place, only the first count of them are alive
+    struct Block {
+        std::size_t count = 0;
+        alignas(TKey) unsigned char key_bytes[BLOCK_SIZE * sizeof(TKey)];
+        alignas(TValue) unsigned char value_bytes[BLOCK_SIZE * sizeof(TValue)];
+
+        Block() = default;
+
+        Block(const Block &) = delete;
+
+        Block &operator=(const Block &) = delete;
+
+        ~Block() {
+            for (std::size_t i = 0; i < count; i++)
+                drop(i);
+        }
+
+        TKey &key(std::size_t i) {
+            return *std::launder(reinterpret_cast<TKey *>(key_bytes) + i);
+        }
+
+        const TKey &key(std::size_t i) const {
+            return *std::launder(reinterpret_cast<const TKey *>(key_bytes) + i);
+        }
+
+        TValue &value(std::size_t i) {
+            return *std::launder(reinterpret_cast<TValue *>(value_bytes) + i);
+        }
+
+        const TValue &value(std::size_t i) const {
+            return *std::launder(reinterpret_cast<const TValue *>(value_bytes) + i);
+        }
+
+        template<class K, class... Args>
+        void put(std::size_t i, K &&k, Args &&... args) {
+            TKey *placed = new(key_bytes + i * sizeof(TKey)) TKey(std::forward<K>(k));
+            try {
+                new(value_bytes + i * sizeof(TValue)) TValue(std::forward<Args>(args)...);
+            } catch (...) {
+                placed->~TKey();
+                throw;
+            }
+        }
+
+        void drop(std::size_t i) {
+            key(i).~TKey();
+            value(i).~TValue();
+        }
+    };
+
+    //every block but the last is full
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::size_t amount = 0;
+    KeyEqual key_equal;
+
+    template<class K>
+    using if_transparent = typename std::enable_if<!std::is_same<K, TKey>::value &&
+                                                   is_transparent_functor<KeyEqual>::value>::type;
+
+    //block and index of the key, block is nullptr if it is missing
+    template<class K>
+    std::pair<Block *, std::size_t> find_key(const K &key) const {
+        for (const std::unique_ptr<Block> &block : blocks)
+            for (std::size_t i = 0; i < block->count; i++)
+                if (key_equal(block->key(i), key))
+                    return std::pair<Block *, std::size_t>(block.get(), i);
+        return std::pair<Block *, std::size_t>(nullptr, 0);
+    }
+
+    template<class K, class... Args>
+    std::pair<TValue *, bool> emplace_key(K &&key, Args &&... args) {
+        std::pair<Block *, std::size_t> place = find_key(key);
+        if (place.first != nullptr)
+            return std::pair<TValue *, bool>(&place.first->value(place.second), false);
+
+        if (blocks.empty() || blocks.back()->count == BLOCK_SIZE)
+            blocks.emplace_back(new Block);
+        Block &block = *blocks.back();
+        block.put(block.count, std::forward<K>(key), std::forward<Args>(args)...);
+        amount++;
+        return std::pair<TValue *, bool>(&block.value(block.count++), true);
+    }
+
+    template<class K, class V>
+    void assign(K &&key, V &&value) {
+        std::pair<TValue *, bool> place = emplace_key(std::forward<K>(key), std::forward<V>(value));
+        if (!place.second)
+            *place.first = std::forward<V>(value);
+    }
+
+    //the last entry of the last block is moved over the hole, an emptied last block is freed;
+    //if the move throws, both entries are still alive and the size is unchanged
+    void remove(Block &block, std::size_t i) {
+        Block &last = *blocks.back();
+        std::size_t tail = last.count - 1;
+        if (&block != &last || i != tail) {
+            block.key(i) = std::move(last.key(tail));
+            block.value(i) = std::move(last.value(tail));
+        }
+        last.drop(tail);
+        last.count--;
+        amount--;
+        if (last.count == 0)
+            blocks.pop_back();
+    }
+
+public:
+    UnrolledListDictionary() = default;
+
+    std::size_t Size() const {
+        return amount;
+    }
+
+    using Dictionary<TKey, TValue>::Get;
+
+    virtual const TValue &Get(const TKey &key) const {
+        std::pair<Block *, std::size_t> place = find_key(key);
+        if (place.first != nullptr)
+            return place.first->value(place.second);
+
+        throw DictionaryNotFoundException<TKey>(key);
+    }
+
+    virtual const TValue *TryGet(const TKey &key) const {
+        std::pair<Block *, std::size_t> place = find_key(key);
+        return place.first != nullptr ? &place.first->value(place.second) : nullptr;
+    }
+
+    virtual void Set(const TKey &key, const TValue &value) {
+        assign(key, value);
+    }
+
+    void Set(const TKey &key, TValue &&value) {
+        assign(key, std::move(value));
+    }
+
+    void Set(TKey &&key, const TValue &value) {
+        assign(std::move(key), value);
+    }
+
+    void Set(TKey &&key, TValue &&value) {
+        assign(std::move(key), std::move(value));
+    }
+
+    //constructs the value from args only if the key is missing, returns true if it was inserted
+    template<class... Args>
+    bool TryEmplace(const TKey &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...).second;
+    }
+
+    template<class... Args>
+    bool TryEmplace(TKey &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...).second;
+    }
+
+    //returns the value of the key, a missing key is inserted with factory() first
+    template<class Factory>
+    TValue &GetOrInsert(const TKey &key, Factory &&factory) {
+        return *emplace_key(key, DeferredValue<Factory>{factory}).first;
+    }
+
+    //applies fn to the value of the key in place, a missing key is inserted with TValue() first
+    template<class Fn>
+    void Upsert(const TKey &key, Fn &&fn) {
+        fn(*emplace_key(key).first);
+    }
+
+    virtual bool IsSet(const TKey &key) const {
+        return find_key(key).first != nullptr;
+    }
+
+    //heterogeneous lookup: K is compared with stored keys directly, TKey is built only for the exception
+    template<class K, class = if_transparent<K>>
+    const TValue &Get(const K &key) const {
+        std::pair<Block *, std::size_t> place = find_key(key);
+        if (place.first != nullptr)
+            return place.first->value(place.second);
+
+        throw DictionaryNotFoundException<TKey>(TKey(key));
+    }
+
+    template<class K, class = if_transparent<K>>
+    const TValue *TryGet(const K &key) const {
+        std::pair<Block *, std::size_t> place = find_key(key);
+        return place.first != nullptr ? &place.first->value(place.second) : nullptr;
+    }
+
+    template<class K, class = if_transparent<K>>
+    bool IsSet(const K &key) const {
+        return find_key(key).first != nullptr;
+    }
+
+    virtual bool Erase(const TKey &key) {
+        std::pair<Block *, std::size_t> place = find_key(key);
+        if (place.first == nullptr)
+            return false;
+
+        remove(*place.first, place.second);
+        return true;
+    }
+
+    virtual std::size_t EraseIf(const std::function<bool(const TKey &, const TValue &)> &predicate) {
+        std::size_t removed = 0;
+        for (std::size_t b = 0; b < blocks.size(); b++) {
+            std::size_t i = 0;
+            //a removed entry is replaced by the last one, so the same index is checked again
+            while (b < blocks.size() && i < blocks[b]->count)
+                if (predicate(blocks[b]->key(i), blocks[b]->value(i))) {
+                    remove(*blocks[b], i);
+                    removed++;
+                } else
+                    i++;
+        }
+        return removed;
+    }
+};
+
+//hints for BestDictionary, combined with "|":
+//ORDERED_HINT needs keys in order with ordered traversal, COMPACT_HINT trades speed for memory where an
+//engine with smaller nodes is available (comparable keys without ORDERED_HINT), LINEAR_HINT accepts an O(n)
+//engine for "=="-only keys without the deprecation warning
+enum DictionaryHint : unsigned {
+    NO_HINT = 0,
+    ORDERED_HINT = 1,
+    COMPACT_HINT = 2,
+    LINEAR_HINT = 4
 };
 
+//engines BestDictionary chooses from
+enum class DictionaryEngine {
+    FLAT_HASH,
+    TREE,
+    SLAB_TREE,
+    BTREE,
+    COMPACT_TREE,
+    LINEAR
+};
+
+template<class TKey, class TValue, DictionaryEngine Engine>
+struct dictionary_engine;
+
+template<class TKey, class TValue>
+struct dictionary_engine<TKey, TValue, DictionaryEngine::FLAT_HASH> {
+    typedef FlatHashDictionary<TKey, TValue> type;
+};
+
+template<class TKey, class TValue>
+struct dictionary_engine<TKey, TValue, DictionaryEngine::TREE> {
+    typedef TreeDictionary<TKey, TValue> type;
+};
+
+//one chunk allocation per 256 nodes instead of a heap block with its header per node
+template<class TKey, class TValue>
+struct dictionary_engine<TKey, TValue, DictionaryEngine::SLAB_TREE> {
+    typedef TreeDictionary<TKey, TValue, std::less<TKey>, SlabNodeAllocator<>> type;
+};
+
+template<class TKey, class TValue>
+struct dictionary_engine<TKey, TValue, DictionaryEngine::BTREE> {
+    typedef BTreeDictionary<TKey, TValue> type;
+};
+
+template<class TKey, class TValue>
+struct dictionary_engine<TKey, TValue, DictionaryEngine::COMPACT_TREE> {
+    typedef CompactTreeDictionary<TKey, TValue> type;
+};
+
+template<class TKey, class TValue>
+struct dictionary_engine<TKey, TValue, DictionaryEngine::LINEAR> {
+    typedef UnrolledListDictionary<TKey, TValue> type;
+};
+
+//the deprecated overload is picked only by a fallback to O(n) without LINEAR_HINT,
+//so the warning shows where such a BestDictionary is instantiated
+[[deprecated("BestDictionary: the key has neither std::hash nor \"<\", lookups are O(n); "
+             "add a hash or an order, or pass LINEAR_HINT")]]
+constexpr std::true_type linear_fallback(std::true_type) {
+    return std::true_type();
+}
+
+constexpr std::false_type linear_fallback(std::false_type) {
+    return std::false_type();
+}
+
+//picks the engine by the key capabilities and hints at compile time:
+//ordered - TreeDictionary; otherwise hashable - FlatHashDictionary, comparable - BTreeDictionary
+//(CompactTreeDictionary if compact), "==" only - UnrolledListDictionary;
+//CompactTreeDictionary has no ordered traversal, so for ORDERED_HINT the compact hint only swaps the
+//allocator: the slab keeps the same pointer-based nodes and saves just the per-node heap block headers
+template<class TKey, class TValue, unsigned Hints = NO_HINT>
+struct best_engine {
+    static constexpr bool ORDERED = (Hints & ORDERED_HINT) != 0;
+    static constexpr bool COMPACT = (Hints & COMPACT_HINT) != 0;
+    static constexpr bool HASHABLE = is_std_hashable<TKey>::value && is_equal<TKey>::value;
+    static constexpr bool COMPARABLE = is_comparable<TKey>::value && is_equal<TKey>::value;
+
+    static_assert(is_equal<TKey>::value, "BestDictionary: the key needs at least \"==\"");
+    static_assert(!ORDERED || COMPARABLE, "BestDictionary: ORDERED_HINT needs \"<\" and \"==\" on the key");
+
+    static constexpr DictionaryEngine ENGINE =
+            ORDERED ? (COMPACT ? DictionaryEngine::SLAB_TREE : DictionaryEngine::TREE) :
+            HASHABLE ? DictionaryEngine::FLAT_HASH :
+            COMPARABLE ? (COMPACT ? DictionaryEngine::COMPACT_TREE : DictionaryEngine::BTREE) :
+            DictionaryEngine::LINEAR;
+
+    //O(n) engine chosen without LINEAR_HINT
+    static constexpr bool IMPLICIT_LINEAR = ENGINE == DictionaryEngine::LINEAR && (Hints & LINEAR_HINT) == 0;
+};
+
+//the chosen engine, warns through linear_fallback on an implicit O(n) choice
+template<class TKey, class TValue, unsigned Hints = NO_HINT>
+struct best_dictionary : best_engine<TKey, TValue, Hints> {
+    typedef best_engine<TKey, TValue, Hints> Choice;
+    typedef decltype(linear_fallback(std::bool_constant<Choice::IMPLICIT_LINEAR>())) fallback;
+
+    typedef typename dictionary_engine<TKey, TValue, Choice::ENGINE>::type type;
+};
+
+//the fastest dictionary the key supports, see best_engine
+template<class TKey, class TValue, unsigned Hints = NO_HINT>
+using BestDictionary = typename best_dictionary<TKey, TValue, Hints>::type;
+
 #endif //DICTIONARY_MY_DICTIONARY_H